@@ -0,0 +1,10 @@
+// Buffer cache statistics, from bcachestat().
+struct bcachestat {
+  uint64 hits;                 // lookups of a block already cached
+  uint64 misses;               // lookups that needed a buffer
+  uint64 readaheads;           // blocks read ahead of need
+  uint64 evictions;            // cached blocks dropped for others or for memory
+  uint64 grows;                // pages of buffers added
+  uint64 shrinks;              // pages given back to kalloc()
+  int nbuf;                    // buffers in the cache
+};
@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -12,6 +12,9 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+// * To keep several disk requests in flight, use bread_async
+//     and bwrite_async, then bwait (or bwaitmany) before
+//     using or releasing the buffers.
 
 
 #include "types.h"
@@ -22,70 +25,295 @@
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
+#include "bcachestat.h"
 
-struct {
+#define NBUCKET 13
+#define NBATCH  16  // most disk requests started together
+
+// Buffers are kept in a hash table keyed by (dev, blockno),
+// so that looking up a cached block locks only its bucket.
+// Each bucket's lock protects its list and the refcnt and
+// lastuse of the buffers on it. A buffer's dev and blockno,
+// and so its bucket, change only when it is recycled, which
+// takes bcache.lock as well, so only one hart at a time
+// moves buffers between buckets.
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf *head;
+};
+
+// The NBUF buffers in bcache.buf are always there. While more
+// than BGROWMIN pages of memory are free, and more are free
+// than the cache has added, a miss adds a page of new buffers
+// instead; so the cache takes at most about half of the memory
+// it finds free. When kalloc() or kalloc_pages() runs out of
+// memory, breclaim() gives such pages back.
+#define BGROWMIN 1024
+
+// A page of added buffers. Pages none of whose buffers are in
+// use are kept on bcache.idle, in the order they became idle,
+// so that breclaim() takes the first without a search.
+// A struct buf is a little more than BSIZE bytes, so a page
+// holds three, and about 700 bytes of it go unused: the price
+// of keeping each buffer's data next to its header.
+struct bpage {
+  struct bpage *prev, *next;  // on bcache.idle, if busy is 0
+  uint busy;                  // buffers in use; under idlelock
+  struct buf buf[(PGSIZE - 3*sizeof(void*)) / sizeof(struct buf)];
+};
+#define BPERPAGE NELEM(((struct bpage*)0)->buf)
 
-  // Linked list of all buffers, through prev/next.
-  // Sorted by how recently the buffer was used.
-  // head.next is most recent, head.prev is least.
-  struct buf head;
+struct {
+  struct spinlock lock;  // serializes recycling and breclaim()
+  struct buf buf[NBUF];
+  struct bucket bucket[NBUCKET];
+  int npages;            // pages of added buffers; under lock
+  struct spinlock idlelock;  // idle and every page's busy
+  struct bpage *idle;    // pages with no buffer in use, LRU first
+  struct bpage *idletail;
+  struct bcachestat stat;
 } bcache;
 
+static void bput(struct buf*);
+static void bdone(struct buf*);
+
+static struct bucket*
+bucket(uint dev, uint blockno)
+{
+  return &bcache.bucket[(dev * 31 + blockno) % NBUCKET];
+}
+
 void
 binit(void)
 {
   struct buf *b;
 
   initlock(&bcache.lock, "bcache");
+  initlock(&bcache.idlelock, "bcache.idle");
+  for(int i = 0; i < NBUCKET; i++)
+    initlock(&bcache.bucket[i].lock, "bcache.bucket");
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
+  // Start every buffer off in bucket 0; recycling moves
+  // them to the buckets of the blocks they cache.
   for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->next = bcache.bucket[0].head;
+    bcache.bucket[0].head = b;
+  }
+  bcache.stat.nbuf = NBUF;
+}
+
+// Put pg at the end of the idle list, or take it off.
+// Caller must hold bcache.idlelock.
+static void
+idleput(struct bpage *pg)
+{
+  pg->next = 0;
+  pg->prev = bcache.idletail;
+  if(bcache.idletail)
+    bcache.idletail->next = pg;
+  else
+    bcache.idle = pg;
+  bcache.idletail = pg;
+}
+
+static void
+idledel(struct bpage *pg)
+{
+  if(pg->prev)
+    pg->prev->next = pg->next;
+  else
+    bcache.idle = pg->next;
+  if(pg->next)
+    pg->next->prev = pg->prev;
+  else
+    bcache.idletail = pg->prev;
+}
+
+// b's refcnt has gone from 0 to 1 (delta 1) or from 1 to 0
+// (delta -1). If b is an added buffer, keep the count of its
+// page's buffers in use, and so the idle list, up to date.
+static void
+bpagebusy(struct buf *b, int delta)
+{
+  struct bpage *pg;
+
+  if(b >= bcache.buf && b < &bcache.buf[NBUF])
+    return;
+  pg = (struct bpage*)PGROUNDDOWN((uint64)b);
+  acquire(&bcache.idlelock);
+  if(delta > 0 && pg->busy++ == 0)
+    idledel(pg);
+  else if(delta < 0 && --pg->busy == 0)
+    idleput(pg);
+  release(&bcache.idlelock);
+}
+
+// Take a reference to b.
+// Caller must hold b's bucket lock.
+static void
+bref(struct buf *b)
+{
+  if(b->refcnt++ == 0)
+    bpagebusy(b, 1);
+}
+
+// Drop a reference to b, returning how many are left.
+// Caller must hold b's bucket lock.
+static uint
+bunref(struct buf *b)
+{
+  if(--b->refcnt == 0)
+    bpagebusy(b, -1);
+  return b->refcnt;
+}
+
+// Add the buffers in page pg to the cache, unused, in
+// bucket 0 as binit() does.
+// Caller must hold bcache.lock.
+static void
+bgrow(struct bpage *pg)
+{
+  struct bucket *bk = &bcache.bucket[0];
+  struct buf *b;
+
+  memset(pg, 0, PGSIZE);
+  bcache.npages++;
+  acquire(&bcache.idlelock);
+  idleput(pg);
+  release(&bcache.idlelock);
+  acquire(&bk->lock);
+  for(b = pg->buf; b < &pg->buf[BPERPAGE]; b++){
+    initsleeplock(&b->lock, "buffer");
+    b->next = bk->head;
+    bk->head = b;
   }
+  release(&bk->lock);
+  bcache.stat.grows++;
+  bcache.stat.nbuf += BPERPAGE;
+}
+
+// Look for block (dev, blockno) in bucket bk.
+// Caller must hold bk->lock.
+static struct buf*
+bfind(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bk->head; b; b = b->next)
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
+  return 0;
 }
 
 // Look through buffer cache for block on device dev.
 // If not found, allocate a buffer.
 // In either case, return locked buffer.
+// For read-ahead (ahead set), return 0 instead if the
+// block is cached already, or if giving it a buffer
+// would leave few buffers unused.
 static struct buf*
-bget(uint dev, uint blockno)
+bget(uint dev, uint blockno, int ahead)
 {
-  struct buf *b;
+  struct bucket *bk = bucket(dev, blockno), *vbk, *obk;
+  struct buf *b, *victim, **bp;
+  struct bpage *pg;
+  int nfree, npg;
 
+  acquire(&bk->lock);
+  if((b = bfind(bk, dev, blockno)) != 0 && !ahead)
+    bref(b);
+  release(&bk->lock);
+  if(b){
+    if(ahead)
+      return 0;
+    __sync_fetch_and_add(&bcache.stat.hits, 1);
+    acquiresleep(&b->lock);
+    return b;
+  }
+
+  // Not cached. Grow the cache if memory is plentiful (not
+  // under bcache.lock, as kalloc() may call breclaim()).
+  // npages is only a hint here.
+  // Then recycle the least recently used unused buffer, in
+  // whatever bucket it is, which is a new one if the cache
+  // grew. Another hart may have cached the block meanwhile,
+  // so look again once only this hart can be recycling.
+  pg = 0;
+  npg = kfreepages();
+  if(npg > BGROWMIN && npg > bcache.npages)
+    pg = kalloc();
   acquire(&bcache.lock);
+  if(pg)
+    bgrow(pg);
+  acquire(&bk->lock);
+  if((b = bfind(bk, dev, blockno)) != 0){
+    if(!ahead)
+      bref(b);
+    release(&bk->lock);
+    release(&bcache.lock);
+    if(ahead)
+      return 0;
+    __sync_fetch_and_add(&bcache.stat.hits, 1);
+    acquiresleep(&b->lock);
+    return b;
+  }
 
-  // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  // Keep the victim's bucket locked until it is moved, so
+  // that it can't be taken meanwhile.
+  victim = 0;
+  vbk = 0;
+  nfree = 0;
+  for(obk = bcache.bucket; obk < &bcache.bucket[NBUCKET]; obk++){
+    if(obk != bk)
+      acquire(&obk->lock);
+    for(b = obk->head; b; b = b->next){
+      if(b->refcnt == 0)
+        nfree++;
+      if(b->refcnt == 0 && (victim == 0 || b->lastuse < victim->lastuse)){
+        victim = b;
+        if(vbk != obk){
+          if(vbk && vbk != bk)
+            release(&vbk->lock);
+          vbk = obk;
+        }
+      }
     }
+    if(obk != bk && obk != vbk)
+      release(&obk->lock);
   }
+  if(ahead && nfree <= NBUF/2){
+    if(vbk && vbk != bk)
+      release(&vbk->lock);
+    release(&bk->lock);
+    release(&bcache.lock);
+    return 0;
+  }
+  if(victim == 0)
+    panic("bget: no buffers");
+  if(victim->valid)
+    bcache.stat.evictions++;
+  if(ahead)
+    bcache.stat.readaheads++;
+  else
+    bcache.stat.misses++;
 
-  // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  if(vbk != bk){
+    for(bp = &vbk->head; *bp != victim; bp = &(*bp)->next)
+      ;
+    *bp = victim->next;
+    release(&vbk->lock);
+    victim->next = bk->head;
+    bk->head = victim;
   }
-  panic("bget: no buffers");
+  victim->dev = dev;
+  victim->blockno = blockno;
+  victim->valid = 0;
+  bref(victim);
+  release(&bk->lock);
+  release(&bcache.lock);
+  acquiresleep(&victim->lock);
+  return victim;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -94,7 +322,7 @@ bread(uint dev, uint blockno)
 {
   struct buf *b;
 
-  b = bget(dev, blockno);
+  b = bget(dev, blockno, 0);
   if(!b->valid) {
     virtio_disk_rw(b, 0);
     b->valid = 1;
@@ -102,6 +330,116 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Start reading the n blocks in blocknos into the cache,
+// skipping those that are there already, and return without
+// waiting for them. A bread() of one of them then waits
+// only for the rest of its disk read, if any.
+void
+breadahead(uint dev, uint *blocknos, int n)
+{
+  struct buf *rd[NBATCH], *b;
+  int nrd = 0;
+
+  for(int i = 0; i < n; i++){
+    if((b = bget(dev, blocknos[i], 1)) != 0){
+      b->iodone = bdone;
+      rd[nrd++] = b;
+    }
+    if(nrd == NBATCH || (i == n-1 && nrd > 0)){
+      virtio_disk_startv(rd, nrd, 0);
+      nrd = 0;
+    }
+  }
+}
+
+// The disk has finished a read started by breadahead().
+// Unlock b and drop breadahead()'s reference to it, as
+// brelse() would. Called from virtio_disk_intr().
+static void
+bdone(struct buf *b)
+{
+  b->valid = 1;
+  releasesleep(&b->lock);
+  bput(b);
+}
+
+// Like bread(), but don't wait for the disk: return the
+// locked buf at once, and start reading the block into it
+// if it isn't cached. Call bwait() before using the data.
+// Several reads started this way are in flight together.
+struct buf*
+bread_async(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno, 0);
+  if(!b->valid) {
+    virtio_disk_start(b, 0);
+    b->valid = 1;  // once bwait() returns
+  }
+  return b;
+}
+
+// bread_async() each of the n blocks in blocknos, into
+// bs[0..n-1], giving the disk the reads together.
+void
+breadmany_async(uint dev, uint *blocknos, int n, struct buf **bs)
+{
+  struct buf *rd[NBATCH];
+  int nrd = 0;
+
+  for(int i = 0; i < n; i++){
+    bs[i] = bget(dev, blocknos[i], 0);
+    if(!bs[i]->valid){
+      bs[i]->valid = 1;  // once bwait() returns
+      rd[nrd++] = bs[i];
+    }
+    if(nrd == NBATCH || (i == n-1 && nrd > 0)){
+      virtio_disk_startv(rd, nrd, 0);
+      nrd = 0;
+    }
+  }
+}
+
+// Start writing b's contents to disk.  Must be locked.
+// Call bwait() before changing or releasing b.
+void
+bwrite_async(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bwrite_async");
+  virtio_disk_start(b, 1);
+}
+
+// bwrite_async() each of the n bufs in bs, giving the disk
+// the writes together.
+void
+bwritemany_async(struct buf **bs, int n)
+{
+  for(int i = 0; i < n; i++)
+    if(!holdingsleep(&bs[i]->lock))
+      panic("bwritemany_async");
+  virtio_disk_startv(bs, n, 1);
+}
+
+// Wait for the disk to finish the bread_async() or
+// bwrite_async() of b.  Must be locked.
+void
+bwait(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bwait");
+  virtio_disk_wait(b);
+}
+
+// bwait() for each of the n bufs in bs.
+void
+bwaitmany(struct buf **bs, int n)
+{
+  for(int i = 0; i < n; i++)
+    bwait(bs[i]);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -111,43 +449,132 @@ bwrite(struct buf *b)
   virtio_disk_rw(b, 1);
 }
 
+// Drop a reference to b.
+// Note when it was last used, for bget()'s recycling.
+static void
+bput(struct buf *b)
+{
+  struct bucket *bk = bucket(b->dev, b->blockno);
+
+  acquire(&bk->lock);
+  if(bunref(b) == 0){
+    // no one is waiting for it.
+    b->lastuse = r_time();
+  }
+  release(&bk->lock);
+}
+
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
 void
 brelse(struct buf *b)
 {
   if(!holdingsleep(&b->lock))
     panic("brelse");
+  if(b->disk)
+    panic("brelse: disk busy");
 
   releasesleep(&b->lock);
-
-  acquire(&bcache.lock);
-  b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
-  
-  release(&bcache.lock);
+  bput(b);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
-  b->refcnt++;
-  release(&bcache.lock);
+  struct bucket *bk = bucket(b->dev, b->blockno);
+
+  acquire(&bk->lock);
+  bref(b);
+  release(&bk->lock);
 }
 
 void
 bunpin(struct buf *b) {
+  struct bucket *bk = bucket(b->dev, b->blockno);
+
+  acquire(&bk->lock);
+  bunref(b);
+  release(&bk->lock);
+}
+
+// Take the page of added buffers that has been idle longest
+// out of the cache, or return 0 if no page is idle.
+static struct bpage*
+bshrink(void)
+{
+  struct bpage *pg;
+  struct bucket *bk;
+  struct buf *b, **bp;
+  int busy;
+
   acquire(&bcache.lock);
-  b->refcnt--;
+  for(;;){
+    acquire(&bcache.idlelock);
+    pg = bcache.idle;
+    release(&bcache.idlelock);
+    if(pg == 0)
+      break;
+
+    // lock the buckets pg's buffers are in (bcache.lock
+    // keeps them there); then none of their refcnts can
+    // change, and pg stays idle if it still is.
+    for(b = pg->buf; b < &pg->buf[BPERPAGE]; b++){
+      bk = bucket(b->dev, b->blockno);
+      if(!holding(&bk->lock))
+        acquire(&bk->lock);
+    }
+    acquire(&bcache.idlelock);
+    if((busy = pg->busy) == 0)
+      idledel(pg);
+    release(&bcache.idlelock);
+
+    if(busy == 0){
+      for(b = pg->buf; b < &pg->buf[BPERPAGE]; b++){
+        bk = bucket(b->dev, b->blockno);
+        for(bp = &bk->head; *bp != b; bp = &(*bp)->next)
+          ;
+        *bp = b->next;
+        if(b->valid)
+          bcache.stat.evictions++;
+      }
+      bcache.npages--;
+      bcache.stat.shrinks++;
+      bcache.stat.nbuf -= BPERPAGE;
+    }
+    for(b = pg->buf; b < &pg->buf[BPERPAGE]; b++){
+      bk = bucket(b->dev, b->blockno);
+      if(holding(&bk->lock))
+        release(&bk->lock);
+    }
+    if(busy == 0)
+      break;
+    // a buffer in pg was taken meanwhile; try the next.
+  }
   release(&bcache.lock);
+  return pg;
 }
 
+// Give up to n pages of added buffers back to kalloc(),
+// those idle longest first. Called by kalloc() and
+// kalloc_pages() when memory runs out, so bio.c never calls
+// kalloc() holding its own locks.
+// Returns the number of pages freed.
+int
+breclaim(int n)
+{
+  struct bpage *pg;
+  int freed = 0;
+
+  while(freed < n && (pg = bshrink()) != 0){
+    kfree(pg);
+    freed++;
+  }
+  return freed;
+}
 
+// Copy the buffer cache's statistics to *st.
+void
+bstat(struct bcachestat *st)
+{
+  acquire(&bcache.lock);
+  *st = bcache.stat;
+  release(&bcache.lock);
+}
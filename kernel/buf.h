@@ -1,12 +1,14 @@
 struct buf {
   int valid;   // has data been read from disk?
   int disk;    // does disk "own" buf?
+  void (*iodone)(struct buf*); // if set, virtio_disk_intr() calls it
+                               // instead of waking up bwait()
   uint dev;
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
-  struct buf *next;
+  uint64 lastuse;   // time of last brelse(), for recycling
+  struct buf *next; // hash bucket list
   uchar data[BSIZE];
 };
 
@@ -1,11 +1,15 @@
+struct bcachestat;
 struct buf;
 struct context;
 struct file;
 struct inode;
+struct kmem_cache;
+struct mm;
 struct pipe;
 struct proc;
 struct spinlock;
 struct sleeplock;
+struct spawnact;
 struct stat;
 struct superblock;
 
@@ -16,6 +20,15 @@ void            brelse(struct buf*);
 void            bwrite(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+void            breadahead(uint, uint*, int);
+struct buf*     bread_async(uint, uint);
+void            breadmany_async(uint, uint*, int, struct buf**);
+void            bwrite_async(struct buf*);
+void            bwritemany_async(struct buf**, int);
+void            bwait(struct buf*);
+void            bwaitmany(struct buf**, int);
+int             breclaim(int);
+void            bstat(struct bcachestat*);
 
 // console.c
 void            consoleinit(void);
@@ -24,6 +37,7 @@ void            consputc(int);
 
 // exec.c
 int             exec(char*, char**);
+int             exec_image(struct proc*, char*, char**);
 
 // file.c
 struct file*    filealloc(void);
@@ -59,10 +73,23 @@ void            ramdiskinit(void);
 void            ramdiskintr(void);
 void            ramdiskrw(struct buf*);
 
+// futex.c
+void            futexinit(void);
+int             futex_wait(uint64, int);
+int             futex_wake(uint64, int);
+
 // kalloc.c
 void*           kalloc(void);
 void            kfree(void *);
 void            kinit(void);
+void*           kalloc_pages(int);
+void*           ktry_pages(int);
+void            kfree_pages(void *, int);
+void*           kzalloc(void);
+void            kdup(void *);
+int             krefs(void *);
+int             kzerofill(void);
+int             kfreepages(void);
 
 // log.c
 void            initlog(int, struct superblock*);
@@ -70,7 +97,19 @@ void            log_write(struct buf*);
 void            begin_op(void);
 void            end_op(void);
 
+// mmap.c
+void            pcacheinit(void);
+void            pcachewrite(struct inode*, uint, char*, uint);
+void            pcachedrop(struct inode*);
+uint64          mmapbase(struct mm*);
+uint64          mmap(uint64, int, int, struct file*, uint);
+int             munmap(uint64, uint64);
+void            munmapall(struct proc*);
+int             mmapcopy(struct proc*, struct proc*);
+int             mmapfault(struct proc*, uint64, int, int);
+
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
@@ -85,9 +124,16 @@ void            printfinit(void);
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
-int             growproc(int);
+int             spawn(char*, char**, struct spawnact*, int);
+int             clone(uint64, uint64, uint64);
+int             join(int, uint64);
+uint64          growproc(int);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
+void            mapbegin(struct mm*);
+void            mapend(struct mm*);
+void            shootdown(struct mm*, int);
+void            tlbflush(void);
 int             kill(int);
 struct cpu*     mycpu(void);
 struct cpu*     getmycpu(void);
@@ -100,14 +146,26 @@ void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(uint64);
 void            wakeup(void*);
+void            wakeup_one(void*);
+int             wakeupn(void*, int);
 void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
+int             setpriority(int, int);
+int             setaffinity(int, uint64);
+int             procstat(int, uint64);
+int             schedtick(void);
+void            priboost(void);
 
 // swtch.S
 void            swtch(struct context*, struct context*);
 
+// slab.c
+struct kmem_cache* kmem_cache_create(char*, uint, void (*)(void*));
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(struct kmem_cache*, void*);
+
 // spinlock.c
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
@@ -139,12 +197,21 @@ int             fetchstr(uint64, char*, int);
 int             fetchaddr(uint64, uint64*);
 void            syscall();
 
+// timer.c
+void            timerinit(void);
+void            timerexpire(uint64);
+uint64          timernext(void);
+int             timersleep(uint64);
+
 // trap.c
 extern uint     ticks;
 void            trapinit(void);
 void            trapinithart(void);
 extern struct spinlock tickslock;
 void            usertrapret(void);
+void            tickupdate(void);
+void            timerbusy(void);
+void            timeridle(void);
 
 // uart.c
 void            uartinit(void);
@@ -157,16 +224,25 @@ int             uartgetc(void);
 void            kvminit(void);
 void            kvminithart(void);
 uint64          kvmpa(uint64);
+pagetable_t     kvmcreate(pagetable_t);
+int             uvmdevmap(pagetable_t);
+void            uvmdevunmap(pagetable_t);
 void            kvmmap(uint64, uint64, uint64, int);
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
 pagetable_t     uvmcreate(void);
 void            uvminit(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
+int             uvmlazy(pagetable_t, uint64, uint64);
+int             uvmcow(pagetable_t, uint64);
+int             uvmfault(struct proc*, uint64, int, int);
+int             uvmrevoke(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmshare(pagetable_t, pagetable_t, uint64, uint64, int);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
+pte_t *         walk(pagetable_t, uint64, int);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
@@ -181,6 +257,9 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_start(struct buf *, int);
+void            virtio_disk_startv(struct buf **, int, int);
+void            virtio_disk_wait(struct buf *);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
@@ -11,6 +11,18 @@ static int loadseg(pde_t *pgdir, uint64 addr, struct inode *ip, uint offset, uin
 
 int
 exec(char *path, char **argv)
+{
+  return exec_image(myproc(), path, argv);
+}
+
+// Replace p's user memory with a fresh image of the
+// program at path, with argv on its stack, and set up
+// p's trapframe to start it. p need not be the current
+// process; spawn() uses this to fill in a new child.
+// p must be the only thread using its memory (see clone()).
+// Returns argc, or -1 with p unchanged.
+int
+exec_image(struct proc *p, char *path, char **argv)
 {
   char *s, *last;
   int i, off;
@@ -19,7 +31,12 @@ exec(char *path, char **argv)
   struct inode *ip;
   struct proghdr ph;
   pagetable_t pagetable = 0, oldpagetable;
-  struct proc *p = myproc();
+  struct mm *mm = p->mm;
+
+  // other threads, even exited ones that haven't been
+  // joined, have their trapframes in the page table.
+  if(mm->ref > 1)
+    return -1;
 
   begin_op();
 
@@ -46,7 +63,7 @@ exec(char *path, char **argv)
       continue;
     if(ph.memsz < ph.filesz)
       goto bad;
-    if(ph.vaddr + ph.memsz < ph.vaddr)
+    if(ph.vaddr + ph.memsz < ph.vaddr || ph.vaddr + ph.memsz > MMAPTOP)
       goto bad;
     uint64 sz1;
     if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz)) == 0)
@@ -61,17 +78,19 @@ exec(char *path, char **argv)
   end_op();
   ip = 0;
 
-  p = myproc();
-  uint64 oldsz = p->sz;
+  uint64 oldsz = mm->sz;
 
   // Allocate two pages at the next page boundary.
   // Use the second as the user stack.
   sz = PGROUNDUP(sz);
-  uint64 sz1;
+  uint64 sz1, guard;
+  if(sz + 2*PGSIZE > MMAPTOP)
+    goto bad;
   if((sz1 = uvmalloc(pagetable, sz, sz + 2*PGSIZE)) == 0)
     goto bad;
   sz = sz1;
-  uvmclear(pagetable, sz-2*PGSIZE);
+  guard = sz-2*PGSIZE;
+  uvmclear(pagetable, guard);
   sp = sz;
   stackbase = sp - PGSIZE;
 
@@ -109,11 +128,21 @@ exec(char *path, char **argv)
   safestrcpy(p->name, last, sizeof(p->name));
     
   // Commit to the user image.
+  munmapall(p);
   oldpagetable = p->pagetable;
-  p->pagetable = pagetable;
-  p->sz = sz;
+  p->pagetable = mm->pagetable = pagetable;
+  p->kpagetable[0] = pagetable[0];
+  if(p == myproc())
+    sfence_vma();
+  mm->sz = sz;
+  mm->guard = guard;
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
+  // proc_pagetable() put the trapframe in the first slot,
+  // wherever p had it before.
+  uvmunmap(oldpagetable, p->tfva, 1, 0);
+  p->tfva = TRAPFRAME;
+  mm->tfmask = 1;
   proc_freepagetable(oldpagetable, oldsz);
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
@@ -162,9 +162,14 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
+// In-memory inodes come from inodecache and are kept on the
+// icache.list. An entry whose ip->ref drops to zero is free for
+// reuse; once the list holds more than NINODE entries, such an
+// entry is given back to inodecache instead.
+//
 // The icache.lock spin-lock protects the allocation of icache
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
+// entries and the list. Since ip->ref indicates whether an entry
+// is free, and ip->dev and ip->inum indicate which i-node an entry
 // holds, one must hold icache.lock while using any of those fields.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
@@ -173,18 +178,25 @@ bfree(int dev, uint b)
 
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode *list;   // all in-memory inodes, linked by next/prev
+  int n;                // length of list
 } icache;
 
+struct kmem_cache *inodecache;
+
+static void
+inodector(void *o)
+{
+  struct inode *ip = o;
+
+  initsleeplock(&ip->lock, "inode");
+}
+
 void
 iinit()
 {
-  int i = 0;
-  
   initlock(&icache.lock, "icache");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
-  }
+  inodecache = kmem_cache_create("inode", sizeof(struct inode), inodector);
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -248,7 +260,7 @@ iget(uint dev, uint inum)
 
   // Is the inode already cached?
   empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
+  for(ip = icache.list; ip; ip = ip->next){
     if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
       ip->ref++;
       release(&icache.lock);
@@ -258,9 +270,17 @@ iget(uint dev, uint inum)
       empty = ip;
   }
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
-    panic("iget: no inodes");
+  // Recycle an inode cache entry, or grow the cache.
+  if(empty == 0){
+    if((empty = kmem_cache_alloc(inodecache)) == 0)
+      panic("iget: no inodes");
+    empty->prev = 0;
+    empty->next = icache.list;
+    if(empty->next)
+      empty->next->prev = empty;
+    icache.list = empty;
+    icache.n++;
+  }
 
   ip = empty;
   ip->dev = dev;
@@ -306,6 +326,7 @@ ilock(struct inode *ip)
     ip->size = dip->size;
     memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
     brelse(bp);
+    ip->ranext = ip->raend = ip->rawin = 0;
     ip->valid = 1;
     if(ip->type == 0)
       panic("ilock: no type");
@@ -354,6 +375,16 @@ iput(struct inode *ip)
   }
 
   ip->ref--;
+  if(ip->ref == 0 && icache.n > NINODE){
+    if(ip->prev)
+      ip->prev->next = ip->next;
+    else
+      icache.list = ip->next;
+    if(ip->next)
+      ip->next->prev = ip->prev;
+    icache.n--;
+    kmem_cache_free(inodecache, ip);
+  }
   release(&icache.lock);
 }
 
@@ -404,6 +435,25 @@ bmap(struct inode *ip, uint bn)
   panic("bmap: out of range");
 }
 
+// Like bmap(), but return 0 rather than allocate a block.
+static uint
+bpeek(struct inode *ip, uint bn)
+{
+  uint addr = 0;
+  struct buf *bp;
+
+  if(bn < NDIRECT)
+    return ip->addrs[bn];
+  bn -= NDIRECT;
+
+  if(bn < NINDIRECT && ip->addrs[NDIRECT]){
+    bp = bread(ip->dev, ip->addrs[NDIRECT]);
+    addr = ((uint*)bp->data)[bn];
+    brelse(bp);
+  }
+  return addr;
+}
+
 // Truncate inode (discard contents).
 // Caller must hold ip->lock.
 void
@@ -413,6 +463,8 @@ itrunc(struct inode *ip)
   struct buf *bp;
   uint *a;
 
+  pcachedrop(ip);
+  ip->ranext = ip->raend = ip->rawin = 0;
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
@@ -448,6 +500,51 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+#define RAMIN  4   // read-ahead window, in blocks, of a new sequential reader
+#define RAMAX 32   // largest read-ahead window
+
+// Read-ahead for a read of n > 0 bytes at off. If it starts
+// where the previous read of ip left off (or in that read's
+// last block), start reading its blocks and the next rawin
+// after them into the buffer cache, and double rawin, up to
+// RAMAX; blocks already started are skipped. Any other read
+// closes the window.
+// Caller must hold ip->lock.
+static void
+readahead(struct inode *ip, uint off, uint n)
+{
+  uint bn = off / BSIZE, last = (off + n - 1) / BSIZE;
+  uint b, end, addr, addrs[RAMAX];
+  int na = 0;
+
+  if(bn == ip->ranext || bn + 1 == ip->ranext){
+    ip->rawin = ip->rawin ? ip->rawin * 2 : RAMIN;
+    if(ip->rawin > RAMAX)
+      ip->rawin = RAMAX;
+  } else {
+    ip->rawin = 0;
+    ip->raend = 0;
+  }
+  ip->ranext = last + 1;
+  if(ip->rawin == 0)
+    return;
+
+  end = last + 1 + ip->rawin;
+  if(end > (ip->size + BSIZE - 1) / BSIZE)
+    end = (ip->size + BSIZE - 1) / BSIZE;
+  for(b = ip->raend > bn ? ip->raend : bn; b < end; b++){
+    if((addr = bpeek(ip, b)) != 0)
+      addrs[na++] = addr;
+    if(na == RAMAX){
+      breadahead(ip->dev, addrs, na);
+      na = 0;
+    }
+  }
+  breadahead(ip->dev, addrs, na);
+  if(end > ip->raend)
+    ip->raend = end;
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
@@ -462,6 +559,8 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
     return 0;
   if(off + n > ip->size)
     n = ip->size - off;
+  if(n > 0)
+    readahead(ip, off, n);
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
@@ -497,6 +596,7 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
       brelse(bp);
       break;
     }
+    pcachewrite(ip, off, (char*)bp->data + (off % BSIZE), m);
     log_write(bp);
     brelse(bp);
   }
@@ -0,0 +1,130 @@
+// Futexes: sleeping on a word of user memory.
+//
+// futex_wait(addr, val) sleeps if the int at user address
+// addr still holds val, and futex_wake(addr, n) wakes up to
+// n threads sleeping on addr. User code does the fast path
+// with atomic instructions and calls into the kernel only
+// to block or to wake a blocked thread (see mutex_lock() in
+// user/ulib.c).
+//
+// A futex is named by its address space and its user
+// address, so futexes work between the threads of a
+// process (see clone()). Waiters are kept in a hash table
+// of queues, oldest first; a bucket's lock is held from
+// futex_wait()'s check of the word until the waiter is on
+// the queue, so a futex_wake() that follows a change to the
+// word can't miss it.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+#define NFUTEX 31
+
+struct fwaiter {
+  struct mm *mm;
+  uint64 addr;
+  int woken;
+  struct fwaiter *next;
+};
+
+struct fbucket {
+  struct spinlock lock;
+  struct fwaiter *head;
+};
+static struct fbucket futexes[NFUTEX];
+
+static struct fbucket*
+fbucket(struct mm *mm, uint64 addr)
+{
+  return &futexes[(((uint64)mm >> 6) ^ (addr >> 2)) % NFUTEX];
+}
+
+void
+futexinit(void)
+{
+  for(int i = 0; i < NFUTEX; i++)
+    initlock(&futexes[i].lock, "futex");
+}
+
+// Sleep on the futex at user address addr, if the int there
+// is val. Returns 0 when woken by futex_wake(), or -1 if the
+// int is not val, addr is bad, or the thread is killed.
+// May also return 0 spuriously; callers re-check the word.
+int
+futex_wait(uint64 addr, int val)
+{
+  struct proc *p = myproc();
+  struct fbucket *b = fbucket(p->mm, addr);
+  struct fwaiter w, **wp;
+  int cur;
+
+  if(addr % sizeof(int) != 0)
+    return -1;
+
+  // fault the page in where that may sleep, then read the
+  // word again with the bucket locked, which can only fail
+  // if another thread unmaps the page meanwhile.
+  for(;;){
+    if(copyin(p->pagetable, (char*)&cur, addr, sizeof(cur)) < 0)
+      return -1;
+    acquire(&b->lock);
+    if(copyin(p->pagetable, (char*)&cur, addr, sizeof(cur)) == 0)
+      break;
+    release(&b->lock);
+  }
+  if(cur != val){
+    release(&b->lock);
+    return -1;
+  }
+
+  w.mm = p->mm;
+  w.addr = addr;
+  w.woken = 0;
+  w.next = 0;
+  for(wp = &b->head; *wp; wp = &(*wp)->next)
+    ;
+  *wp = &w;
+
+  while(!w.woken && !p->killed)
+    sleep(&w, &b->lock);
+
+  if(!w.woken){
+    for(wp = &b->head; *wp != &w; wp = &(*wp)->next)
+      ;
+    *wp = w.next;
+  }
+  release(&b->lock);
+  return w.woken ? 0 : -1;
+}
+
+// Wake up to n threads sleeping on the futex at user
+// address addr, those that have slept longest first.
+// Returns the number woken.
+int
+futex_wake(uint64 addr, int n)
+{
+  struct mm *mm = myproc()->mm;
+  struct fbucket *b = fbucket(mm, addr);
+  struct fwaiter *w, **wp;
+  int woken = 0;
+
+  acquire(&b->lock);
+  wp = &b->head;
+  while((w = *wp) != 0 && woken < n){
+    if(w->mm == mm && w->addr == addr){
+      *wp = w->next;
+      w->woken = 1;
+      wakeup(w);
+      woken++;
+    } else {
+      wp = &w->next;
+    }
+  }
+  release(&b->lock);
+  return woken;
+}
@@ -1,6 +1,31 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// and pipe buffers. Allocates whole 4096-byte pages,
+// or physically contiguous blocks of 2^order pages.
+//
+// Free memory is kept by a binary buddy allocator: a free
+// block of 2^order pages starts at a page number that is a
+// multiple of 2^order (counting from KERNBASE), and when it
+// is freed it is merged with its buddy, the neighbouring
+// block of the same order, whenever that buddy is free too.
+//
+// Each hart keeps a private cache of free single pages so
+// that the common kalloc()/kfree() path only touches a lock
+// that no other hart normally wants. Pages move between
+// a hart's cache and the buddy allocator KCACHE_BATCH at a
+// time; a hart whose cache and the buddy allocator are both
+// empty steals half of another hart's cache.
+//
+// Harts with nothing to run zero free pages ahead of time
+// (see kzerofill()), so that kzalloc() can usually hand out
+// a zero-filled page without clearing it on the spot.
+//
+// Every allocated page carries a reference count, so that
+// copy-on-write fork can share a page between processes;
+// kfree() only frees the page when the last reference goes.
+//
+// Building with KALLOC_DEBUG fills freed and newly
+// allocated pages with junk to catch dangling references.
 
 #include "types.h"
 #include "param.h"
@@ -9,6 +34,16 @@
 #include "riscv.h"
 #include "defs.h"
 
+#define KCACHE_BATCH 32                 // pages moved per refill or spill
+#define KCACHE_HIGH  (4*KCACHE_BATCH)   // spill when a cache grows past this
+#define KMAXORDER    11                 // largest block is 2^(KMAXORDER-1) pages
+#define NZERO        256                // pre-zeroed pages to keep ready
+#define KZEROMIN     512                // free pages kzerofill() leaves alone
+
+#define NPAGE    ((PHYSTOP - KERNBASE) / PGSIZE)
+#define PA2PG(pa) (((uint64)(pa) - KERNBASE) >> PGSHIFT)
+#define PG2PA(pg) (KERNBASE + ((uint64)(pg) << PGSHIFT))
+
 void freerange(void *pa_start, void *pa_end);
 
 extern char end[]; // first address after kernel.
@@ -16,50 +51,306 @@ extern char end[]; // first address after kernel.
 
 struct run {
   struct run *next;
+  struct run *prev;   // buddy free lists only
+};
+
+// per-page state, indexed by PA2PG().
+struct page {
+  char free;    // first page of a free buddy block?
+  char order;   // if so, the block is 2^order pages
+  int ref;      // references to an allocated page
 };
 
+// buddy allocator, shared by all harts.
 struct {
   struct spinlock lock;
-  struct run *freelist;
+  struct run *freelist[KMAXORDER];  // free blocks of each order
+  int nfree;                        // free pages in the lists
+  struct page pages[NPAGE];
 } kmem;
 
+// per-hart caches. the lock is only contended
+// when another hart steals from this cache.
+struct kcache {
+  struct spinlock lock;
+  struct run *freelist;
+  int nfree;
+} kcache[NCPU];
+
+// pages known to be all zeros, apart from the
+// run link in the first word while on the list.
+struct {
+  struct spinlock lock;
+  struct run *freelist;
+  int n;
+} kzero;
+
 void
 kinit()
 {
   initlock(&kmem.lock, "kmem");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&kcache[i].lock, "kcache");
+  initlock(&kzero.lock, "kzero");
   freerange(end, (void*)PHYSTOP);
 }
 
+// Take a page from the pre-zeroed pool, or return 0.
+static void*
+kzero_pop(void)
+{
+  struct run *r;
+
+  acquire(&kzero.lock);
+  r = kzero.freelist;
+  if(r){
+    kzero.freelist = r->next;
+    kzero.n--;
+  }
+  release(&kzero.lock);
+  if(r){
+    r->next = 0;
+    kmem.pages[PA2PG(r)].ref = 1;
+  }
+  return (void*)r;
+}
+
+// Return a block of 2^order pages to the buddy lists,
+// merging it with its buddy as long as the buddy is free.
+// Caller must hold kmem.lock.
+static void
+buddy_free(void *pa, int order)
+{
+  uint64 pg, buddy;
+  struct run *r;
+
+  pg = PA2PG(pa);
+  while(order < KMAXORDER-1){
+    buddy = pg ^ (1L << order);
+    if(buddy >= NPAGE || !kmem.pages[buddy].free ||
+       kmem.pages[buddy].order != order)
+      break;
+    // unlink the buddy and merge.
+    r = (struct run*)PG2PA(buddy);
+    if(r->prev)
+      r->prev->next = r->next;
+    else
+      kmem.freelist[order] = r->next;
+    if(r->next)
+      r->next->prev = r->prev;
+    kmem.pages[buddy].free = 0;
+    pg &= ~(1L << order);
+    order++;
+  }
+
+  r = (struct run*)PG2PA(pg);
+  r->prev = 0;
+  r->next = kmem.freelist[order];
+  if(r->next)
+    r->next->prev = r;
+  kmem.freelist[order] = r;
+  kmem.pages[pg].free = 1;
+  kmem.pages[pg].order = order;
+}
+
+// Remove a block of 2^order pages from the buddy lists,
+// splitting a larger block if need be.
+// Caller must hold kmem.lock.
+static void*
+buddy_alloc(int order)
+{
+  struct run *r, *h;
+  uint64 pg;
+  int o;
+
+  for(o = order; o < KMAXORDER && kmem.freelist[o] == 0; o++)
+    ;
+  if(o == KMAXORDER)
+    return 0;
+
+  r = kmem.freelist[o];
+  kmem.freelist[o] = r->next;
+  if(r->next)
+    r->next->prev = 0;
+  pg = PA2PG(r);
+  kmem.pages[pg].free = 0;
+
+  // give back the upper halves until the block is the right size.
+  while(o > order){
+    o--;
+    h = (struct run*)PG2PA(pg + (1L << o));
+    h->prev = 0;
+    h->next = kmem.freelist[o];
+    if(h->next)
+      h->next->prev = h;
+    kmem.freelist[o] = h;
+    kmem.pages[pg + (1L << o)].free = 1;
+    kmem.pages[pg + (1L << o)].order = o;
+  }
+  return (void*)r;
+}
+
 void
 freerange(void *pa_start, void *pa_end)
 {
   char *p;
   p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
-    kfree(p);
+  acquire(&kmem.lock);
+  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE){
+    buddy_free(p, 0);
+    kmem.nfree++;
+  }
+  release(&kmem.lock);
+}
+
+// Detach up to n pages from the front of *list, which holds
+// *nfree pages. Returns the detached chain and its tail in *tailp.
+static struct run*
+ktake(struct run **list, int *nfree, int n, struct run **tailp, int *got)
+{
+  struct run *head, *tail;
+  int i;
+
+  head = tail = *list;
+  if(head == 0 || n <= 0){
+    *got = 0;
+    return 0;
+  }
+  for(i = 1; i < n && tail->next; i++)
+    tail = tail->next;
+  *list = tail->next;
+  tail->next = 0;
+  *nfree -= i;
+  *tailp = tail;
+  *got = i;
+  return head;
 }
 
-// Free the page of physical memory pointed at by v,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// Find a batch of free pages for hart id, first in the
+// buddy allocator and then in other harts' caches.
+// Called without any kalloc locks held.
+static struct run*
+krefill(int id, struct run **tailp, int *got)
+{
+  struct run *r, *head;
+  struct kcache *kc;
+  int n;
+
+  head = 0;
+  acquire(&kmem.lock);
+  for(n = 0; n < KCACHE_BATCH && (r = buddy_alloc(0)) != 0; n++){
+    if(head == 0)
+      *tailp = r;
+    r->next = head;
+    head = r;
+  }
+  kmem.nfree -= n;
+  release(&kmem.lock);
+  if(head){
+    *got = n;
+    return head;
+  }
+
+  for(int i = 1; i < NCPU; i++){
+    kc = &kcache[(id + i) % NCPU];
+    acquire(&kc->lock);
+    r = ktake(&kc->freelist, &kc->nfree, (kc->nfree + 1) / 2, tailp, got);
+    release(&kc->lock);
+    if(r)
+      return r;
+  }
+  return 0;
+}
+
+// Drop a reference to the page of physical memory pointed
+// at by pa, which normally should have been returned by a
+// call to kalloc(), and free it if that was the last one.
+// (The exception is when initializing the allocator;
+// see kinit above.)
 void
 kfree(void *pa)
 {
-  struct run *r;
+  struct run *r, *spill, *tail;
+  struct kcache *kc;
+  int n;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  n = __sync_sub_and_fetch(&kmem.pages[PA2PG(pa)].ref, 1);
+  if(n > 0)
+    return;
+  if(n < 0)
+    panic("kfree: ref");
+
+#ifdef KALLOC_DEBUG
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
+#endif
 
   r = (struct run*)pa;
 
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  push_off();
+  kc = &kcache[cpuid()];
+  acquire(&kc->lock);
+  r->next = kc->freelist;
+  kc->freelist = r;
+  kc->nfree++;
+  spill = 0;
+  if(kc->nfree > KCACHE_HIGH)
+    spill = ktake(&kc->freelist, &kc->nfree, KCACHE_BATCH, &tail, &n);
+  release(&kc->lock);
+
+  if(spill){
+    acquire(&kmem.lock);
+    while(spill){
+      r = spill;
+      spill = r->next;
+      buddy_free(r, 0);
+    }
+    kmem.nfree += n;
+    release(&kmem.lock);
+  }
+  pop_off();
+}
+
+// Take one page from this hart's cache, or else from the
+// buddy allocator, and give it a reference.
+// Returns 0 if both are empty.
+static struct run *
+kalloc_page(void)
+{
+  struct run *r, *tail;
+  struct kcache *kc;
+  int id, n;
+
+  push_off();
+  id = cpuid();
+  kc = &kcache[id];
+
+  acquire(&kc->lock);
+  r = kc->freelist;
+  if(r){
+    kc->freelist = r->next;
+    kc->nfree--;
+  }
+  release(&kc->lock);
+
+  if(r == 0 && (r = krefill(id, &tail, &n)) != 0){
+    // keep the first page, cache the rest.
+    if(r->next){
+      acquire(&kc->lock);
+      tail->next = kc->freelist;
+      kc->freelist = r->next;
+      kc->nfree += n - 1;
+      release(&kc->lock);
+    }
+  }
+  pop_off();
+
+  if(r)
+    kmem.pages[PA2PG(r)].ref = 1;
+  return r;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -70,13 +361,258 @@ kalloc(void)
 {
   struct run *r;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+  r = kalloc_page();
+
+  // last resort: pages that were zeroed ahead of time,
+  // or else pages the buffer cache can give back.
+  if(r == 0)
+    r = kzero_pop();
+  if(r == 0 && breclaim(1))
+    return kalloc();
 
+#ifdef KALLOC_DEBUG
   if(r)
     memset((char*)r, 5, PGSIZE); // fill with junk
+#endif
   return (void*)r;
 }
+
+// Number of free pages. The count may be stale by the
+// time the caller looks at it.
+int
+kfreepages(void)
+{
+  int n = kmem.nfree + kzero.n;
+
+  for(int i = 0; i < NCPU; i++)
+    n += kcache[i].nfree;
+  return n;
+}
+
+// Allocate one zero-filled page, like kalloc() followed by
+// memset(), but usually without paying for the memset.
+void *
+kzalloc(void)
+{
+  void *pa;
+
+  if((pa = kzero_pop()) == 0 && (pa = kalloc()) != 0)
+    memset(pa, 0, PGSIZE);
+  return pa;
+}
+
+// Add a reference to an allocated page.
+void
+kdup(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kdup");
+  __sync_fetch_and_add(&kmem.pages[PA2PG(pa)].ref, 1);
+}
+
+// Number of references to an allocated page.
+int
+krefs(void *pa)
+{
+  return __atomic_load_n(&kmem.pages[PA2PG(pa)].ref, __ATOMIC_SEQ_CST);
+}
+
+// Zero one free page and add it to the pre-zeroed pool.
+// Called by harts that have nothing else to do. The page
+// comes only from the caches or the buddy allocator, never
+// from kalloc()'s last resorts, and only while more than
+// KZEROMIN pages are free, so that zeroing ahead doesn't
+// shrink the buffer cache or take the last free pages.
+// Returns 0 if the pool is full or memory is short.
+int
+kzerofill(void)
+{
+  struct run *r;
+
+  if(kzero.n >= NZERO || kfreepages() - kzero.n <= KZEROMIN)
+    return 0;
+  if((r = kalloc_page()) == 0)
+    return 0;
+  memset(r, 0, PGSIZE);
+
+  acquire(&kzero.lock);
+  if(kzero.n >= NZERO){
+    release(&kzero.lock);
+    kfree(r);
+    return 0;
+  }
+  r->next = kzero.freelist;
+  kzero.freelist = r;
+  kzero.n++;
+  release(&kzero.lock);
+  return 1;
+}
+
+// Give every hart's cached pages, and the pre-zeroed pool,
+// back to the buddy allocator, so that they can be merged
+// into larger blocks.
+static void
+kdrain(void)
+{
+  struct run *r, *list;
+  struct kcache *kc;
+  int n;
+
+  acquire(&kzero.lock);
+  list = kzero.freelist;
+  n = kzero.n;
+  kzero.freelist = 0;
+  kzero.n = 0;
+  release(&kzero.lock);
+  acquire(&kmem.lock);
+  while(list){
+    r = list;
+    list = r->next;
+    buddy_free(r, 0);
+  }
+  kmem.nfree += n;
+  release(&kmem.lock);
+
+  for(kc = kcache; kc < &kcache[NCPU]; kc++){
+    acquire(&kc->lock);
+    list = kc->freelist;
+    n = kc->nfree;
+    kc->freelist = 0;
+    kc->nfree = 0;
+    release(&kc->lock);
+
+    acquire(&kmem.lock);
+    while(list){
+      r = list;
+      list = r->next;
+      buddy_free(r, 0);
+    }
+    kmem.nfree += n;
+    release(&kmem.lock);
+  }
+}
+
+// Take a block of 2^order pages from the buddy allocator,
+// if drain is set first giving it the pages in the per-hart
+// caches and the pre-zeroed pool should there be no such
+// block. Returns 0 if there is none.
+static void *
+kalloc_block(int order, int drain)
+{
+  void *pa = 0;
+
+  if(order < 0 || order >= KMAXORDER)
+    return 0;
+  if(order == 0)
+    return kalloc();
+
+  for(int pass = 0; pass < 2; pass++){
+    acquire(&kmem.lock);
+    pa = buddy_alloc(order);
+    if(pa)
+      kmem.nfree -= 1 << order;
+    release(&kmem.lock);
+    if(pa || pass == 1 || !drain)
+      break;
+    // pages sitting in the per-hart caches may be
+    // what keeps a large block from forming.
+    kdrain();
+  }
+
+  if(pa){
+    for(int i = 0; i < (1 << order); i++)
+      kmem.pages[PA2PG(pa) + i].ref = 1;
+  }
+
+#ifdef KALLOC_DEBUG
+  if(pa)
+    memset(pa, 5, PGSIZE << order); // fill with junk
+#endif
+  return pa;
+}
+
+// Allocate 2^order physically contiguous pages, aligned
+// to their size relative to KERNBASE (so a block of order 9
+// starts on a 2-megabyte boundary). If there is no such
+// block, take memory back from the buffer cache, 2^order
+// pages at a time, until one forms or the cache has none
+// left to give.
+// Returns 0 if no large enough block can be had.
+void *
+kalloc_pages(int order)
+{
+  void *pa;
+
+  if(order < 0 || order >= KMAXORDER)
+    return 0;
+  while((pa = kalloc_block(order, 1)) == 0 && breclaim(1 << order) > 0)
+    ;
+  return pa;
+}
+
+// Like kalloc_pages(), but only if the buddy allocator has
+// a block free now: for callers that can make do with
+// single pages, and shouldn't empty the per-hart caches
+// and the pre-zeroed pool just to try.
+void *
+ktry_pages(int order)
+{
+  // an unlocked look, to skip the lock when memory is short.
+  if(kmem.nfree < (1 << order))
+    return 0;
+  return kalloc_block(order, 0);
+}
+
+// Drop a reference to each page of a block returned by
+// kalloc_pages(order). Each page of the block has its own
+// reference count (a megapage of user memory may be shared
+// copy-on-write page by page), so the block is only freed
+// as a whole if none of its pages is still referenced;
+// otherwise just the pages whose count reached zero are.
+void
+kfree_pages(void *pa, int order)
+{
+  uint64 pg, zeroed[(1 << (KMAXORDER-1)) / 64];
+  int i, n, nzero;
+
+  if(order == 0){
+    kfree(pa);
+    return;
+  }
+  if(order < 0 || order >= KMAXORDER ||
+     ((uint64)pa - KERNBASE) % (PGSIZE << order) != 0 ||
+     (char*)pa < end || (uint64)pa + (PGSIZE << order) > PHYSTOP)
+    panic("kfree_pages");
+
+  // note which pages our own decrement freed; another
+  // hart may be freeing the others by themselves.
+  pg = PA2PG(pa);
+  nzero = 0;
+  memset(zeroed, 0, sizeof(zeroed));
+  for(i = 0; i < (1 << order); i++){
+    n = __sync_sub_and_fetch(&kmem.pages[pg + i].ref, 1);
+    if(n < 0)
+      panic("kfree_pages: ref");
+    if(n == 0){
+      zeroed[i / 64] |= 1L << (i % 64);
+      nzero++;
+    }
+  }
+  if(nzero == 0)
+    return;
+
+  acquire(&kmem.lock);
+  if(nzero == (1 << order)){
+#ifdef KALLOC_DEBUG
+    // Fill with junk to catch dangling refs.
+    memset(pa, 1, PGSIZE << order);
+#endif
+    buddy_free(pa, order);
+  } else {
+    for(i = 0; i < (1 << order); i++)
+      if(zeroed[i / 64] & (1L << (i % 64)))
+        buddy_free((void*)PG2PA(pg + i), 0);
+  }
+  kmem.nfree += nzero;
+  release(&kmem.lock);
+}
@@ -64,20 +64,35 @@ initlog(int dev, struct superblock *sb)
   recover_from_log();
 }
 
-// Copy committed blocks from log to their home location
+// Copy committed blocks from log to their home location,
+// LOGBATCH at a time with the disk writes overlapped.
 static void
-install_trans(void)
+install_trans(int recovering)
 {
-  int tail;
-
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
+  struct buf *lbuf[LOGBATCH], *dbuf[LOGBATCH];
+  uint lblock[LOGBATCH];
+  int tail, i, n;
+
+  for (tail = 0; tail < log.lh.n; tail += n) {
+    n = log.lh.n - tail;
+    if (n > LOGBATCH)
+      n = LOGBATCH;
+    for (i = 0; i < n; i++)
+      lblock[i] = log.start+tail+i+1;
+    breadmany_async(log.dev, lblock, n, lbuf); // read log blocks
+    for (i = 0; i < n; i++) {
+      dbuf[i] = bread(log.dev, log.lh.block[tail+i]); // read dst
+      bwait(lbuf[i]);
+      memmove(dbuf[i]->data, lbuf[i]->data, BSIZE);  // copy block to dst
+      brelse(lbuf[i]);
+    }
+    bwritemany_async(dbuf, n);  // write dsts to disk
+    bwaitmany(dbuf, n);
+    for (i = 0; i < n; i++) {
+      if (!recovering)
+        bunpin(dbuf[i]);
+      brelse(dbuf[i]);
+    }
   }
 }
 
@@ -116,7 +131,7 @@ static void
 recover_from_log(void)
 {
   read_head();
-  install_trans(); // if committed, copy from log to disk
+  install_trans(1); // if committed, copy from log to disk
   log.lh.n = 0;
   write_head(); // clear the log
 }
@@ -173,19 +188,32 @@ end_op(void)
   }
 }
 
-// Copy modified blocks from cache to log.
+// Copy modified blocks from cache to log,
+// LOGBATCH at a time with the disk writes overlapped.
 static void
 write_log(void)
 {
-  int tail;
-
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+  struct buf *to[LOGBATCH];
+  uint lblock[LOGBATCH];
+  int tail, i, n;
+
+  for (tail = 0; tail < log.lh.n; tail += n) {
+    n = log.lh.n - tail;
+    if (n > LOGBATCH)
+      n = LOGBATCH;
+    for (i = 0; i < n; i++)
+      lblock[i] = log.start+tail+i+1;
+    breadmany_async(log.dev, lblock, n, to); // log blocks
+    for (i = 0; i < n; i++) {
+      struct buf *from = bread(log.dev, log.lh.block[tail+i]); // cache block
+      bwait(to[i]);
+      memmove(to[i]->data, from->data, BSIZE);
+      brelse(from);
+    }
+    bwritemany_async(to, n);  // write the log
+    bwaitmany(to, n);
+    for (i = 0; i < n; i++)
+      brelse(to[i]);
   }
 }
 
@@ -195,7 +223,7 @@ commit()
   if (log.lh.n > 0) {
     write_log();     // Write modified blocks from cache to log
     write_head();    // Write header to disk -- the real commit
-    install_trans(); // Now install writes to home locations
+    install_trans(0); // Now install writes to home locations
     log.lh.n = 0;
     write_head();    // Erase the transaction from the log
   }
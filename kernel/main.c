@@ -27,6 +27,10 @@ main()
     binit();         // buffer cache
     iinit();         // inode cache
     fileinit();      // file table
+    pipeinit();      // pipe cache
+    pcacheinit();    // page cache for mapped files
+    timerinit();     // timers for sleeping processes
+    futexinit();     // futex wait queues
     virtio_disk_init(); // emulated hard disk
     userinit();      // first user process
     __sync_synchronize();
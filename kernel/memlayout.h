@@ -27,6 +27,7 @@
 
 // local interrupt controller, which contains the timer.
 #define CLINT 0x2000000L
+#define CLINT_MSIP(hartid) (CLINT + 4*(hartid))
 #define CLINT_MTIMECMP(hartid) (CLINT + 0x4000 + 8*(hartid))
 #define CLINT_MTIME (CLINT + 0xBFF8) // cycles since boot.
 
@@ -62,6 +63,14 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   mmap()ed files, allocated downwards from MMAPTOP
+//   ...
+//   TRAPFRAMEK(k) (other threads' trapframes)
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
+// user memory stays below PLIC, since each process's
+// kernel page table maps it alongside the devices.
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+// the k'th thread's trapframe; the first's is TRAPFRAME.
+#define TRAPFRAMEK(k) (TRAPFRAME - (k)*PGSIZE)
+#define MMAPTOP PLIC
@@ -0,0 +1,539 @@
+// Memory-mapped files.
+//
+// mmap() records a region of the process's address space in
+// one of p->mm->vma[], below MMAPTOP and above the heap. No pages
+// are mapped until the process touches them; mmapfault() then
+// maps the file's page from the page cache.
+//
+// The page cache holds the file pages that are currently
+// mapped by some process, so that all mappers of a page share
+// one physical copy. It keeps one reference (see kdup()) to
+// each page, and each mapping keeps another; the cache lets
+// go of a page when its last mapping is unmapped. writei()
+// updates cached pages, so mappings see write()s to the file.
+//
+// A MAP_SHARED mapping maps the cached page itself; pages it
+// wrote to (PTE_D set) are written back to the file through
+// the log when they are unmapped. A MAP_PRIVATE mapping maps
+// the cached page copy-on-write, so a store gives the process
+// a private copy (see uvmcow()).
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "fs.h"
+#include "file.h"
+#include "fcntl.h"
+#include "defs.h"
+
+#define NPCBUCKET 61
+
+struct pcpage {
+  uint dev;
+  uint inum;
+  uint off;                // page-aligned file offset
+  char *pa;                // the page
+  struct pcpage *next;     // in hash bucket
+};
+
+struct {
+  struct spinlock lock;
+  struct pcpage *bucket[NPCBUCKET];
+  int n;                   // cached pages
+} pcache;
+
+static struct kmem_cache *pcpagecache;
+
+#define PCHASH(dev, inum, off) \
+  ((((dev) * 31 + (inum)) * 31 + (off) / PGSIZE) % NPCBUCKET)
+
+void
+pcacheinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+  pcpagecache = kmem_cache_create("pcpage", sizeof(struct pcpage), 0);
+}
+
+// Caller must hold pcache.lock.
+static struct pcpage*
+pcachefind(struct inode *ip, uint off)
+{
+  struct pcpage *e;
+
+  for(e = pcache.bucket[PCHASH(ip->dev, ip->inum, off)]; e; e = e->next)
+    if(e->dev == ip->dev && e->inum == ip->inum && e->off == off)
+      return e;
+  return 0;
+}
+
+// Return the page holding ip's data at page-aligned offset
+// off, reading it in if it isn't cached, with a reference
+// added for the caller. Returns 0 if memory is exhausted, or
+// if the page would have to be read in but cansleep is 0 or
+// the caller is already in the middle of reading or writing
+// ip (as when read() targets a mapping of the same file).
+static char*
+pcacheget(struct inode *ip, uint off, int cansleep)
+{
+  struct pcpage *e, *f;
+  char *pa = 0;
+
+  acquire(&pcache.lock);
+  if((e = pcachefind(ip, off)) != 0){
+    pa = e->pa;
+    kdup(pa);
+  }
+  release(&pcache.lock);
+  if(pa || !cansleep || holdingsleep(&ip->lock))
+    return pa;
+
+  if((pa = kzalloc()) == 0)
+    return 0;
+  if((e = kmem_cache_alloc(pcpagecache)) == 0){
+    kfree(pa);
+    return 0;
+  }
+
+  // hold ip's lock until the page is in the cache, so
+  // that writei() can't change the file in between, and
+  // so that only one process reads a given page in.
+  ilock(ip);
+  acquire(&pcache.lock);
+  if((f = pcachefind(ip, off)) != 0){
+    // another process read it in while we waited for ip.
+    kfree(pa);
+    pa = f->pa;
+    kdup(pa);
+    release(&pcache.lock);
+    iunlock(ip);
+    kmem_cache_free(pcpagecache, e);
+    return pa;
+  }
+  release(&pcache.lock);
+  if(readi(ip, 0, (uint64)pa, off, PGSIZE) < 0){
+    iunlock(ip);
+    kmem_cache_free(pcpagecache, e);
+    kfree(pa);
+    return 0;
+  }
+  acquire(&pcache.lock);
+  e->dev = ip->dev;
+  e->inum = ip->inum;
+  e->off = off;
+  e->pa = pa;
+  e->next = pcache.bucket[PCHASH(ip->dev, ip->inum, off)];
+  pcache.bucket[PCHASH(ip->dev, ip->inum, off)] = e;
+  pcache.n++;
+  kdup(pa);
+  release(&pcache.lock);
+  iunlock(ip);
+  return pa;
+}
+
+// Drop a mapping's reference to page pa, which it got from
+// pcacheget(ip, off) or is a private copy of, and take the
+// cached page out of the cache if no mapping has it any more.
+static void
+pcacheput(struct inode *ip, uint off, char *pa)
+{
+  struct pcpage *e, **pp;
+
+  acquire(&pcache.lock);
+  kfree(pa);
+  for(pp = &pcache.bucket[PCHASH(ip->dev, ip->inum, off)]; (e = *pp); pp = &e->next){
+    if(e->dev != ip->dev || e->inum != ip->inum || e->off != off)
+      continue;
+    if(krefs(e->pa) == 1){
+      *pp = e->next;
+      pcache.n--;
+      kfree(e->pa);
+      kmem_cache_free(pcpagecache, e);
+    }
+    break;
+  }
+  release(&pcache.lock);
+}
+
+// Copy n bytes that writei() just wrote at offset off of ip
+// into the cached page, if there is one. The bytes must lie
+// within one page. Caller holds ip->lock.
+void
+pcachewrite(struct inode *ip, uint off, char *src, uint n)
+{
+  struct pcpage *e;
+
+  if(pcache.n == 0)
+    return;
+  acquire(&pcache.lock);
+  if((e = pcachefind(ip, PGROUNDDOWN(off))) != 0)
+    memmove(e->pa + off % PGSIZE, src, n);
+  release(&pcache.lock);
+}
+
+// Forget ip's cached pages, because ip is being truncated.
+// Existing mappings keep their pages until they are unmapped.
+// Caller holds ip->lock.
+void
+pcachedrop(struct inode *ip)
+{
+  struct pcpage *e, **pp;
+  int i;
+
+  if(pcache.n == 0)
+    return;
+  acquire(&pcache.lock);
+  for(i = 0; i < NPCBUCKET; i++){
+    pp = &pcache.bucket[i];
+    while((e = *pp) != 0){
+      if(e->dev == ip->dev && e->inum == ip->inum){
+        *pp = e->next;
+        pcache.n--;
+        kfree(e->pa);
+        kmem_cache_free(pcpagecache, e);
+      } else {
+        pp = &e->next;
+      }
+    }
+  }
+  release(&pcache.lock);
+}
+
+// Write one page of a shared mapping back to the file.
+// Only the part of the page that lies within the file is
+// written; mappings never grow a file.
+static void
+mmapwriteback(struct inode *ip, uint off, char *pa)
+{
+  uint n;
+
+  begin_op();
+  ilock(ip);
+  if(off < ip->size){
+    n = ip->size - off;
+    if(n > PGSIZE)
+      n = PGSIZE;
+    writei(ip, 0, (uint64)pa, off, n);
+  }
+  iunlock(ip);
+  end_op();
+}
+
+// PTE permission bits for a mapping's PROT_ flags.
+// RISC-V has no write-only pages.
+static int
+vmaperm(struct vma *v)
+{
+  int perm = 0;
+
+  if(v->prot & PROT_READ)
+    perm |= PTE_R;
+  if(v->prot & PROT_WRITE)
+    perm |= PTE_R | PTE_W;
+  if(v->prot & PROT_EXEC)
+    perm |= PTE_X;
+  return perm;
+}
+
+// Caller must hold mm->lock.
+static struct vma*
+vmalookup(struct mm *mm, uint64 va)
+{
+  struct vma *v;
+
+  for(v = mm->vma; v < &mm->vma[NVMA]; v++)
+    if(v->f && va >= v->addr && va < v->addr + v->len)
+      return v;
+  return 0;
+}
+
+// Lowest address used by mm's mappings, or MMAPTOP.
+// The heap may not grow past it.
+// Caller must hold mm->lock.
+uint64
+mmapbase(struct mm *mm)
+{
+  struct vma *v;
+  uint64 base = MMAPTOP;
+
+  for(v = mm->vma; v < &mm->vma[NVMA]; v++)
+    if(v->f && v->addr < base)
+      base = v->addr;
+  return base;
+}
+
+// Map len bytes of file f, starting at page-aligned offset
+// off, into the current process at an address of the
+// kernel's choosing. Returns the address, or -1.
+uint64
+mmap(uint64 len, int prot, int flags, struct file *f, uint off)
+{
+  struct mm *mm = myproc()->mm;
+  struct vma *v, *free = 0;
+  uint64 addr;
+
+  if(len == 0 || len > MMAPTOP || off % PGSIZE != 0)
+    return -1;
+  if(f->type != FD_INODE)
+    return -1;
+  if((flags & (MAP_SHARED|MAP_PRIVATE)) == 0 ||
+     (flags & (MAP_SHARED|MAP_PRIVATE)) == (MAP_SHARED|MAP_PRIVATE))
+    return -1;
+  if((prot & (PROT_READ|PROT_WRITE|PROT_EXEC)) && !f->readable)
+    return -1;
+  if((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable)
+    return -1;
+  len = PGROUNDUP(len);
+
+  mapbegin(mm);
+  for(v = mm->vma; v < &mm->vma[NVMA]; v++)
+    if(v->f == 0){
+      free = v;
+      break;
+    }
+  if(free == 0)
+    goto bad;
+
+  // take the highest gap below MMAPTOP that fits.
+  addr = MMAPTOP;
+again:
+  if(addr < len)
+    goto bad;
+  for(v = mm->vma; v < &mm->vma[NVMA]; v++){
+    if(v->f && v->addr < addr && v->addr + v->len > addr - len){
+      addr = v->addr;
+      goto again;
+    }
+  }
+  addr -= len;
+  if(addr < PGROUNDUP(mm->sz))
+    goto bad;
+
+  free->addr = addr;
+  free->len = len;
+  free->prot = prot;
+  free->flags = flags;
+  free->off = off;
+  free->f = filedup(f);
+  mapend(mm);
+  return addr;
+
+ bad:
+  mapend(mm);
+  return -1;
+}
+
+// Unmap the pages of [va, va+len), part of mapping v,
+// from p's page table.
+static void
+vmaunmap(struct proc *p, struct vma *v, uint64 va, uint64 len)
+{
+  struct inode *ip = v->f->ip;
+  uint64 a, pa;
+  uint off;
+  pte_t *pte;
+
+  for(a = va; a < va + len; a += PGSIZE){
+    // invalid but non-zero if uvmrevoke() got to it first.
+    if((pte = walk(p->pagetable, a, 0)) == 0 || *pte == 0)
+      continue;
+    pa = PTE2PA(*pte);
+    off = v->off + (a - v->addr);
+    if((v->flags & MAP_SHARED) && (*pte & PTE_D))
+      mmapwriteback(ip, off, (char*)pa);
+    *pte = 0;
+    pcacheput(ip, off, (char*)pa);
+  }
+  sfence_vma();
+}
+
+// Remove the mappings of [addr, addr+len) from the current
+// process. The range must lie within one mapping and include
+// its start or its end. Returns 0, or -1.
+int
+munmap(uint64 addr, uint64 len)
+{
+  struct proc *p = myproc();
+  struct mm *mm = p->mm;
+  struct vma *v, old;
+
+  if(addr % PGSIZE != 0 || len == 0)
+    return -1;
+  len = PGROUNDUP(len);
+  mapbegin(mm);
+  if((v = vmalookup(mm, addr)) == 0 || addr + len > v->addr + v->len ||
+     (addr != v->addr && addr + len != v->addr + v->len)){
+    mapend(mm);
+    return -1;
+  }
+
+  // take the range out of the mapping, so that faults on
+  // it fail, then unmap its pages, which may sleep to
+  // write them back.
+  old = *v;
+  if(addr == v->addr){
+    v->addr += len;
+    v->off += len;
+  }
+  v->len -= len;
+  if(v->len == 0)
+    v->f = 0;
+  if(mm->nthread > 1){
+    // other threads may be using the pages.
+    uvmrevoke(mm->pagetable, addr, addr + len);
+    release(&mm->lock);
+    shootdown(mm, 1);
+  } else {
+    release(&mm->lock);
+  }
+
+  vmaunmap(p, &old, addr, len);
+  if(old.len == len)
+    fileclose(old.f);
+
+  acquire(&mm->lock);
+  mapend(mm);
+  return 0;
+}
+
+// Remove all of p's mappings, e.g. when it exits or execs.
+// p must be the only thread left using its memory.
+void
+munmapall(struct proc *p)
+{
+  struct vma *v;
+  struct file *f;
+
+  for(v = p->mm->vma; v < &p->mm->vma[NVMA]; v++){
+    if(v->f == 0)
+      continue;
+    vmaunmap(p, v, v->addr, v->len);
+    f = v->f;
+    v->f = 0;
+    fileclose(f);
+  }
+}
+
+// Give fork()'s child np the same mappings as p. Shared
+// mappings share pages; private ones become copy-on-write.
+// Caller must hold p->mm->lock.
+// Returns 0, or -1 with np left without mappings.
+int
+mmapcopy(struct proc *p, struct proc *np)
+{
+  struct vma *v;
+  int i;
+
+  for(i = 0; i < NVMA; i++){
+    v = &p->mm->vma[i];
+    if(v->f == 0)
+      continue;
+    if(uvmshare(p->pagetable, np->pagetable, v->addr, v->len,
+                (v->flags & MAP_PRIVATE) != 0) < 0)
+      goto bad;
+  }
+  for(i = 0; i < NVMA; i++){
+    np->mm->vma[i] = p->mm->vma[i];
+    if(p->mm->vma[i].f)
+      filedup(p->mm->vma[i].f);
+  }
+  return 0;
+
+ bad:
+  while(--i >= 0){
+    v = &p->mm->vma[i];
+    if(v->f)
+      uvmunmap(np->pagetable, v->addr, v->len / PGSIZE, 1);
+  }
+  return -1;
+}
+
+// Handle a fault at va in p, which needs access (PTE_R, PTE_W
+// or PTE_X) to the page, if va lies in a mapping that allows
+// it. cansleep is 0 if the caller holds a spin lock.
+// Returns 0 if the access can now proceed, or -1.
+int
+mmapfault(struct proc *p, uint64 va, int access, int cansleep)
+{
+  struct mm *mm = p->mm;
+  struct vma *v;
+  struct file *f = 0;
+  struct inode *ip;
+  pte_t *pte;
+  char *pa;
+  uint off;
+  int perm, r = -1;
+
+  acquire(&mm->lock);
+  if((v = vmalookup(mm, va)) == 0)
+    goto out;
+  perm = vmaperm(v);
+  if((perm & access) == 0)
+    goto out;
+  va = PGROUNDDOWN(va);
+  if((pte = walk(mm->pagetable, va, 1)) == 0)
+    goto out;
+
+  if(*pte & PTE_V){
+    if(*pte & PTE_COW){
+      r = uvmcow(mm->pagetable, va);
+      goto out;
+    }
+    // a store to a clean shared page, on hardware
+    // that leaves maintaining PTE_D to software.
+    if(access == PTE_W && (*pte & PTE_W))
+      *pte |= PTE_A | PTE_D;
+    r = (*pte & access) ? 0 : -1;
+    goto out;
+  }
+
+  ip = v->f->ip;
+  off = v->off + (va - v->addr);
+  if(cansleep){
+    // reading the page in may sleep, which can't be done
+    // holding mm->lock. hold on to the file instead, and
+    // check afterwards that no other thread has unmapped
+    // the page, or mapped it first.
+    f = filedup(v->f);
+    release(&mm->lock);
+  }
+  pa = pcacheget(ip, off, cansleep);
+  if(cansleep){
+    acquire(&mm->lock);
+    v = vmalookup(mm, va);
+    pte = walk(mm->pagetable, va, 1);
+    if(pa && (v == 0 || v->f != f || v->off + (va - v->addr) != off ||
+              (vmaperm(v) & access) == 0 || pte == 0 || (*pte & PTE_V))){
+      pcacheput(ip, off, pa);
+      pa = 0;
+      if(pte && (*pte & PTE_V))
+        r = 0;  // retry, against the other thread's mapping.
+    }
+  }
+  if(pa == 0)
+    goto out;
+  perm = vmaperm(v);
+
+  if(v->flags & MAP_SHARED){
+    *pte = PA2PTE(pa) | perm | PTE_U | PTE_V | PTE_A;
+    if(access == PTE_W)
+      *pte |= PTE_D;
+    r = 0;
+    goto out;
+  }
+  *pte = PA2PTE(pa) | (perm & ~PTE_W) | PTE_U | PTE_V | PTE_A;
+  if(perm & PTE_W)
+    *pte |= PTE_COW;
+  r = 0;
+  if(access == PTE_W)
+    r = uvmcow(mm->pagetable, va);
+
+ out:
+  release(&mm->lock);
+  if(f)
+    fileclose(f);
+  return r;
+}
@@ -1,13 +1,18 @@
 #define NPROC        64  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
+#define NPRIO         4  // scheduling priority levels
+#define BOOSTTICKS   50  // ticks between scheduling priority boosts
+#define TIMEFREQ  10000000 // time CSR increments per second in qemu
+#define TICKCYCLES (TIMEFREQ/10) // time per scheduler tick
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NVMA         16  // memory-mapped regions per process
+#define NINODE       50  // unused in-memory i-nodes kept for reuse
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define LOGBATCH     8                // log blocks commit writes at once
+#define NBUF         (LOGSIZE+LOGBATCH)  // minimum size of disk block cache
 #define FSSIZE       1000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
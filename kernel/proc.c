@@ -5,43 +5,164 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
+#include "spawn.h"
+#include "procstat.h"
 
 struct cpu cpus[NCPU];
 
-struct proc proc[NPROC];
+// The process table. proc structs come from proccache
+// on demand, up to NPROC of them, and are never freed:
+// an UNUSED one is recycled by allocproc(). allproc links
+// them through p->nextproc, newest first; since entries are
+// only ever added at the head, the list can be walked
+// without holding proc_lock.
+struct proc *allproc;
+int nproc;
+struct spinlock proc_lock;
+struct kmem_cache *proccache;
+
+// The threads of a process share one struct mm and one
+// struct files (see clone()).
+struct kmem_cache *mmcache;
+struct kmem_cache *filescache;
 
 struct proc *initproc;
 
 int nextpid = 1;
-struct spinlock pid_lock;
+
+// Live procs by pid, for kill() and the like. A proc is in
+// its bucket from allocproc() until freeproc(), which hold
+// p->lock, so lock order is p->lock, then the bucket's lock.
+#define NPIDHASH 64
+struct pidbucket {
+  struct spinlock lock;
+  struct proc *head;
+};
+static struct pidbucket pidhash[NPIDHASH];
+
+// wait_lock protects every p->parent and p->children list,
+// and so keeps a parent's wait() from missing a child's
+// exit(). It must be acquired before any p->lock.
+struct spinlock wait_lock;
+
+// Per-hart queues of RUNNABLE processes, one FIFO for each
+// of NPRIO priority levels (0 is the highest). A process
+// goes on the queue of the hart it last ran on, whose caches
+// may still hold its data, if p->affinity allows; whoever
+// makes it RUNNABLE must hold p->lock (so lock order is
+// p->lock, then the queue's lock). scheduler() takes the
+// first process of the highest non-empty level of its own
+// hart's queue, and steals processes it may run from other
+// harts' queues when that is empty.
+struct runq {
+  struct spinlock lock;
+  struct proc *head[NPRIO];
+  struct proc *tail[NPRIO];
+  int n;                      // length; read without the lock as a hint
+};
+static struct runq runqs[NCPU];
+
+// Harts that have started scheduling, for sched_setaffinity().
+static uint64 cpumask;
+
+// Multi-level feedback: a process starts at level p->nice
+// and drops a level each time it uses up a time slice of
+// QUANTUM(level) ticks, counted across sleeps, so processes
+// that compute a lot sink while ones that mostly wait stay
+// on top. Every BOOSTTICKS ticks priboost() lifts everyone
+// back to their nice level, so that nothing starves.
+#define QUANTUM(prio) (1 << (prio))
+
+// priboost() increments boostepoch; a process not on a run
+// queue at the time picks the boost up from p->boost being
+// stale when it is next queued or charged a tick.
+static uint boostepoch;
+
+static char *procstates[] = {
+[UNUSED]    "unused",
+[USED]      "used  ",
+[SLEEPING]  "sleep ",
+[RUNNABLE]  "runble",
+[RUNNING]   "run   ",
+[ZOMBIE]    "zombie"
+};
+
+// Sleeping processes, hashed by channel, so that wakeup()
+// looks only at the processes sleeping on channels in one
+// bucket. A SLEEPING process is on its channel's bucket,
+// oldest first, and its state changes only with the
+// bucket's lock held; lock order is p->lock, then the
+// bucket's lock, then a run queue's lock.
+#define NSLEEPQ 61
+struct sleepq {
+  struct spinlock lock;
+  struct proc *head;
+  struct proc *tail;
+};
+static struct sleepq sleepqs[NSLEEPQ];
+
+static struct sleepq*
+sleepq(void *chan)
+{
+  return &sleepqs[((uint64)chan >> 3) % NSLEEPQ];
+}
 
 extern void forkret(void);
-static void wakeup1(struct proc *chan);
+static void wakeproc(struct proc *p);
 static void freeproc(struct proc *p);
+static struct mm* mmalloc(struct proc *p);
+static int mmjoin(struct proc *p, struct mm *mm);
+static void mmput(struct proc *p);
+static void filesput(struct proc *p);
+static void setrunnable(struct proc *p);
+static void runqput(struct runq *rq, struct proc *p);
+static void kickidle(int id, struct proc *p);
 
 extern char trampoline[]; // trampoline.S
+extern pagetable_t kernel_pagetable; // vm.c
+
+static void
+procctor(void *o)
+{
+  struct proc *p = o;
+
+  memset(p, 0, sizeof(*p));
+  initlock(&p->lock, "proc");
+}
+
+static void
+mmctor(void *o)
+{
+  struct mm *mm = o;
+
+  memset(mm, 0, sizeof(*mm));
+  initlock(&mm->lock, "mm");
+}
+
+static void
+filesctor(void *o)
+{
+  struct files *files = o;
+
+  memset(files, 0, sizeof(*files));
+  initlock(&files->lock, "files");
+}
 
 // initialize the proc table at boot time.
 void
 procinit(void)
 {
-  struct proc *p;
-  
-  initlock(&pid_lock, "nextpid");
-  for(p = proc; p < &proc[NPROC]; p++) {
-      initlock(&p->lock, "proc");
-
-      // Allocate a page for the process's kernel stack.
-      // Map it high in memory, followed by an invalid
-      // guard page.
-      char *pa = kalloc();
-      if(pa == 0)
-        panic("kalloc");
-      uint64 va = KSTACK((int) (p - proc));
-      kvmmap(va, (uint64)pa, PGSIZE, PTE_R | PTE_W);
-      p->kstack = va;
-  }
-  kvminithart();
+  initlock(&wait_lock, "wait_lock");
+  for(int i = 0; i < NPIDHASH; i++)
+    initlock(&pidhash[i].lock, "pidhash");
+  initlock(&proc_lock, "proctable");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&runqs[i].lock, "runq");
+  for(int i = 0; i < NSLEEPQ; i++)
+    initlock(&sleepqs[i].lock, "sleepq");
+  proccache = kmem_cache_create("proc", sizeof(struct proc), procctor);
+  mmcache = kmem_cache_create("mm", sizeof(struct mm), mmctor);
+  filescache = kmem_cache_create("files", sizeof(struct files), filesctor);
 }
 
 // Must be called with interrupts disabled,
@@ -75,26 +196,128 @@ myproc(void) {
 
 int
 allocpid() {
-  int pid;
-  
-  acquire(&pid_lock);
-  pid = nextpid;
-  nextpid = nextpid + 1;
-  release(&pid_lock);
+  return __sync_fetch_and_add(&nextpid, 1);
+}
 
-  return pid;
+// Add p, which has just been given its pid, to the pid hash.
+// Caller must hold p->lock.
+static void
+pidinsert(struct proc *p)
+{
+  struct pidbucket *b = &pidhash[p->pid % NPIDHASH];
+
+  acquire(&b->lock);
+  p->pidnext = b->head;
+  b->head = p;
+  release(&b->lock);
+}
+
+// Take p out of the pid hash.
+// Caller must hold p->lock.
+static void
+pidremove(struct proc *p)
+{
+  struct pidbucket *b = &pidhash[p->pid % NPIDHASH];
+  struct proc **pp;
+
+  acquire(&b->lock);
+  for(pp = &b->head; *pp != p; pp = &(*pp)->pidnext)
+    ;
+  *pp = p->pidnext;
+  release(&b->lock);
+}
+
+// Find the proc with the given pid, and return it with
+// p->lock held, or return 0 if there is none.
+static struct proc*
+findproc(int pid)
+{
+  struct pidbucket *b = &pidhash[pid % NPIDHASH];
+  struct proc *p;
+
+  if(pid <= 0)
+    return 0;
+  acquire(&b->lock);
+  for(p = b->head; p; p = p->pidnext)
+    if(p->pid == pid)
+      break;
+  release(&b->lock);
+  if(p == 0)
+    return 0;
+  // proc structs are never freed, so p can be locked after
+  // letting go of the bucket; but p may have been freed
+  // and reused for another pid meanwhile.
+  acquire(&p->lock);
+  if(p->pid != pid || p->state == UNUSED){
+    release(&p->lock);
+    return 0;
+  }
+  return p;
 }
 
-// Look in the process table for an UNUSED proc.
+// Make p a child of parent.
+// Caller must hold wait_lock.
+static void
+adopt(struct proc *parent, struct proc *p)
+{
+  p->parent = parent;
+  p->sibling = parent->children;
+  parent->children = p;
+}
+
+// Add a new UNUSED proc to the process table, with
+// a kernel stack mapped high in memory, followed by an
+// invalid guard page.
+// Returns with p->lock held, or 0 if the table is full
+// or memory is exhausted.
+static struct proc*
+procgrow(void)
+{
+  struct proc *p;
+  char *pa;
+  uint64 va;
+
+  acquire(&proc_lock);
+  if(nproc >= NPROC || (p = kmem_cache_alloc(proccache)) == 0){
+    release(&proc_lock);
+    return 0;
+  }
+  va = KSTACK(nproc);
+  if((pa = kalloc()) == 0 ||
+     mappages(kernel_pagetable, va, PGSIZE, (uint64)pa, PTE_R | PTE_W) != 0){
+    if(pa)
+      kfree(pa);
+    kmem_cache_free(proccache, p);
+    release(&proc_lock);
+    return 0;
+  }
+  // the stack is new to this hart's TLB; other harts
+  // have never looked at va, so they need no flush.
+  sfence_vma();
+  p->kstack = va;
+
+  acquire(&p->lock);
+  p->nextproc = allproc;
+  __sync_synchronize();
+  allproc = p;
+  nproc++;
+  release(&proc_lock);
+  return p;
+}
+
+// Look in the process table for an UNUSED proc,
+// growing the table if there is none.
 // If found, initialize state required to run in the kernel,
-// and return with p->lock held.
+// and return with p->lock held. The proc gets an empty
+// address space and no open files of its own or, if share
+// is not 0, joins share's as a new thread.
 // If there are no free procs, or a memory allocation fails, return 0.
 static struct proc*
-allocproc(void)
+allocproc(struct proc *share)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
+  for(p = allproc; p; p = p->nextproc) {
     acquire(&p->lock);
     if(p->state == UNUSED) {
       goto found;
@@ -102,20 +325,56 @@ allocproc(void)
       release(&p->lock);
     }
   }
-  return 0;
+  if((p = procgrow()) == 0)
+    return 0;
 
 found:
   p->pid = allocpid();
+  pidinsert(p);
+  p->state = USED;
+  p->nice = 0;
+  p->affinity = myproc() ? myproc()->affinity : -1;
+  p->cpu = -1;
+  p->nmigrate = 0;
+  p->prio = 0;
+  p->slice = 0;
+  p->boost = boostepoch;
+  p->ticks = 0;
+  p->nvcsw = 0;
+  p->nivcsw = 0;
 
   // Allocate a trapframe page.
   if((p->trapframe = (struct trapframe *)kalloc()) == 0){
+    freeproc(p);
     release(&p->lock);
     return 0;
   }
 
-  // An empty user page table.
-  p->pagetable = proc_pagetable(p);
-  if(p->pagetable == 0){
+  if(share){
+    if(mmjoin(p, share->mm) < 0){
+      freeproc(p);
+      release(&p->lock);
+      return 0;
+    }
+    p->files = share->files;
+    acquire(&p->files->lock);
+    p->files->ref++;
+    release(&p->files->lock);
+  } else {
+    // An empty user page table, and no open files.
+    if((p->mm = mmalloc(p)) == 0 ||
+       (p->files = kmem_cache_alloc(filescache)) == 0){
+      freeproc(p);
+      release(&p->lock);
+      return 0;
+    }
+    p->files->ref = 1;
+  }
+  p->pagetable = p->mm->pagetable;
+
+  // The kernel page table used while running p,
+  // which also maps p's user memory.
+  if((p->kpagetable = kvmcreate(p->pagetable)) == 0){
     freeproc(p);
     release(&p->lock);
     return 0;
@@ -136,15 +395,23 @@ found:
 static void
 freeproc(struct proc *p)
 {
+  if(p->kpagetable)
+    kfree((void*)p->kpagetable);
+  p->kpagetable = 0;
+  if(p->mm)
+    mmput(p);
+  p->mm = 0;
+  p->pagetable = 0;
   if(p->trapframe)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
-  if(p->pagetable)
-    proc_freepagetable(p->pagetable, p->sz);
-  p->pagetable = 0;
-  p->sz = 0;
+  if(p->files)
+    filesput(p);
+  p->files = 0;
+  pidremove(p);
   p->pid = 0;
   p->parent = 0;
+  p->children = 0;
   p->name[0] = 0;
   p->chan = 0;
   p->killed = 0;
@@ -182,6 +449,15 @@ proc_pagetable(struct proc *p)
     return 0;
   }
 
+  // the devices that share the first gigabyte with
+  // user memory, for the process's kernel page table.
+  if(uvmdevmap(pagetable) < 0){
+    uvmunmap(pagetable, TRAMPOLINE, 1, 0);
+    uvmunmap(pagetable, TRAPFRAME, 1, 0);
+    uvmfree(pagetable, 0);
+    return 0;
+  }
+
   return pagetable;
 }
 
@@ -192,9 +468,180 @@ proc_freepagetable(pagetable_t pagetable, uint64 sz)
 {
   uvmunmap(pagetable, TRAMPOLINE, 1, 0);
   uvmunmap(pagetable, TRAPFRAME, 1, 0);
+  uvmdevunmap(pagetable);
   uvmfree(pagetable, sz);
 }
 
+// A new address space for p, with an empty user page table
+// that maps p's trapframe in the first thread's slot.
+// Returns 0 if memory is exhausted.
+static struct mm*
+mmalloc(struct proc *p)
+{
+  struct mm *mm;
+
+  if((mm = kmem_cache_alloc(mmcache)) == 0)
+    return 0;
+  if((mm->pagetable = proc_pagetable(p)) == 0){
+    kmem_cache_free(mmcache, mm);
+    return 0;
+  }
+  mm->mapping = 0;
+  mm->ref = 1;
+  mm->nthread = 1;
+  mm->tfmask = 1;
+  mm->sz = 0;
+  mm->guard = MMAPTOP;
+  memset(mm->vma, 0, sizeof(mm->vma));
+  p->tfva = TRAPFRAME;
+  return mm;
+}
+
+// Make new thread p share mm, mapping p's trapframe in a
+// free slot below TRAPFRAME. There are enough slots for
+// every proc to be a thread of the same process.
+// Returns 0, or -1 if memory is exhausted.
+static int
+mmjoin(struct proc *p, struct mm *mm)
+{
+  int k;
+
+  acquire(&mm->lock);
+  for(k = 0; mm->tfmask & (1L << k); k++)
+    ;
+  if(mappages(mm->pagetable, TRAPFRAMEK(k), PGSIZE,
+              (uint64)p->trapframe, PTE_R | PTE_W) < 0){
+    release(&mm->lock);
+    return -1;
+  }
+  mm->tfmask |= 1L << k;
+  mm->ref++;
+  mm->nthread++;
+  release(&mm->lock);
+  p->mm = mm;
+  p->tfva = TRAPFRAMEK(k);
+  return 0;
+}
+
+// Drop p's use of its address space, unmapping its
+// trapframe. The last user frees the page table and
+// the user memory; mappings of files must already be
+// gone (see exit()).
+static void
+mmput(struct proc *p)
+{
+  struct mm *mm = p->mm;
+  int last;
+
+  acquire(&mm->lock);
+  uvmunmap(mm->pagetable, p->tfva, 1, 0);
+  mm->tfmask &= ~(1L << ((TRAPFRAME - p->tfva) / PGSIZE));
+  last = --mm->ref == 0;
+  release(&mm->lock);
+  if(last){
+    proc_freepagetable(mm->pagetable, mm->sz);
+    kmem_cache_free(mmcache, mm);
+  }
+}
+
+// Drop p's use of its open files. The last user closes them;
+// other callers of freeproc() than exit() leave it nothing to
+// close, since it may not sleep.
+static void
+filesput(struct proc *p)
+{
+  struct files *files = p->files;
+  int last;
+
+  acquire(&files->lock);
+  last = --files->ref == 0;
+  release(&files->lock);
+  if(!last)
+    return;
+  for(int fd = 0; fd < NOFILE; fd++){
+    if(files->ofile[fd]){
+      struct file *f = files->ofile[fd];
+      fileclose(f);
+      files->ofile[fd] = 0;
+    }
+  }
+  kmem_cache_free(filescache, files);
+}
+
+// Start changing mm->sz or mm->vma[]. Such a change may have
+// to let go of mm->lock partway through, to sleep or to wait
+// for other harts (see munmap()), so mm->mapping keeps other
+// threads from starting one meanwhile. Page faults just take
+// mm->lock, and see each step of the change.
+// Returns holding mm->lock.
+void
+mapbegin(struct mm *mm)
+{
+  acquire(&mm->lock);
+  while(mm->mapping)
+    sleep(&mm->mapping, &mm->lock);
+  mm->mapping = 1;
+}
+
+// Finish a change begun by mapbegin().
+// Caller must hold mm->lock, which is released.
+void
+mapend(struct mm *mm)
+{
+  mm->mapping = 0;
+  wakeup_one(&mm->mapping);
+  release(&mm->lock);
+}
+
+// Make the other harts that may be running threads of mm
+// flush their TLBs, after the caller has taken some access
+// away in mm's page table (see uvmrevoke() and uvmcow()),
+// and, if wait is 1, wait until they have. Callers that hold
+// a spin lock must not wait: a hart spinning for the lock
+// with interrupts off would never flush.
+void
+shootdown(struct mm *mm, int wait)
+{
+  struct cpu *c, *me;
+  struct proc *p;
+  uint want[NCPU];
+
+  push_off();
+  me = mycpu();
+  __sync_synchronize();
+  for(c = cpus; c < &cpus[NCPU]; c++){
+    want[c - cpus] = 0;
+    if(c == me || (p = c->proc) == 0 || p->mm != mm)
+      continue;
+    want[c - cpus] = __sync_add_and_fetch(&c->flushreq, 1);
+    sbi_send_ipi(c - cpus);
+  }
+  for(c = cpus; wait && c < &cpus[NCPU]; c++){
+    while(want[c - cpus] &&
+          (int)(__atomic_load_n(&c->flushdone, __ATOMIC_ACQUIRE) - want[c - cpus]) < 0){
+      // that hart may in turn be waiting for this one.
+      tlbflush();
+    }
+  }
+  pop_off();
+}
+
+// Do the TLB flush other harts have asked this one for,
+// if any (see shootdown()).
+// Caller has interrupts off.
+void
+tlbflush(void)
+{
+  struct cpu *c = mycpu();
+  uint req = __atomic_load_n(&c->flushreq, __ATOMIC_ACQUIRE);
+
+  if(req == c->flushdone)
+    return;
+  // flushes the mappings changed before req was asked for.
+  sfence_vma();
+  __atomic_store_n(&c->flushdone, req, __ATOMIC_RELEASE);
+}
+
 // a user program that calls exec("/init")
 // od -t xC initcode
 uchar initcode[] = {
@@ -213,13 +660,13 @@ userinit(void)
 {
   struct proc *p;
 
-  p = allocproc();
+  p = allocproc(0);
   initproc = p;
   
   // allocate one user page and copy init's instructions
   // and data into it.
   uvminit(p->pagetable, initcode, sizeof(initcode));
-  p->sz = PGSIZE;
+  p->mm->sz = PGSIZE;
 
   // prepare for the very first "return" from kernel to user.
   p->trapframe->epc = 0;      // user program counter
@@ -228,29 +675,50 @@ userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  setrunnable(p);
 
   release(&p->lock);
 }
 
 // Grow or shrink user memory by n bytes.
-// Return 0 on success, -1 on failure.
-int
+// Growing only reserves the address space; usertrap()
+// maps each page when the process first touches it.
+// Return the old size, or -1 on failure.
+uint64
 growproc(int n)
 {
-  uint sz;
-  struct proc *p = myproc();
+  uint64 sz, newsz;
+  struct mm *mm = myproc()->mm;
 
-  sz = p->sz;
+  mapbegin(mm);
+  sz = newsz = mm->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n)) == 0) {
-      return -1;
+    if(sz + n > mmapbase(mm))
+      goto bad;
+    newsz = sz + n;
+  } else if(n < 0 && sz + n < sz){
+    newsz = sz + n;
+    // fails, with nothing changed, if there's no memory to
+    // split a megapage; after it nothing can fail.
+    if(uvmrevoke(mm->pagetable, PGROUNDUP(newsz), PGROUNDUP(sz)) < 0)
+      goto bad;
+    if(mm->nthread > 1){
+      // other threads may still reach the pages through
+      // their TLBs; they must drop them before they are freed.
+      mm->sz = newsz;
+      release(&mm->lock);
+      shootdown(mm, 1);
+      acquire(&mm->lock);
     }
-  } else if(n < 0){
-    sz = uvmdealloc(p->pagetable, sz, sz + n);
+    uvmdealloc(mm->pagetable, sz, newsz);
   }
-  p->sz = sz;
-  return 0;
+  mm->sz = newsz;
+  mapend(mm);
+  return sz;
+
+ bad:
+  mapend(mm);
+  return -1;
 }
 
 // Create a new process, copying the parent.
@@ -261,21 +729,33 @@ fork(void)
   int i, pid;
   struct proc *np;
   struct proc *p = myproc();
+  struct mm *mm = p->mm;
 
   // Allocate process.
-  if((np = allocproc()) == 0){
+  if((np = allocproc(0)) == 0){
     return -1;
   }
+  // np is USED, so no one else will take it, and
+  // shootdown() below mustn't wait holding a lock.
+  release(&np->lock);
 
   // Copy user memory from parent to child.
-  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
+  acquire(&mm->lock);
+  if(uvmcopy(p->pagetable, np->pagetable, mm->sz) < 0 ||
+     mmapcopy(p, np) < 0){
+    release(&mm->lock);
+    acquire(&np->lock);
     freeproc(np);
     release(&np->lock);
     return -1;
   }
-  np->sz = p->sz;
-
-  np->parent = p;
+  np->mm->sz = mm->sz;
+  np->mm->guard = mm->guard;
+  release(&mm->lock);
+  // the parent's pages are now copy-on-write, but its
+  // other threads may still have them writable in their TLBs.
+  if(mm->nthread > 1)
+    shootdown(mm, 1);
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
@@ -284,168 +764,598 @@ fork(void)
   np->trapframe->a0 = 0;
 
   // increment reference counts on open file descriptors.
+  acquire(&p->files->lock);
   for(i = 0; i < NOFILE; i++)
-    if(p->ofile[i])
-      np->ofile[i] = filedup(p->ofile[i]);
+    if(p->files->ofile[i])
+      np->files->ofile[i] = filedup(p->files->ofile[i]);
+  release(&p->files->lock);
   np->cwd = idup(p->cwd);
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
+  np->nice = np->prio = p->nice;
+
   pid = np->pid;
 
-  np->state = RUNNABLE;
+  acquire(&wait_lock);
+  adopt(p, np);
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  setrunnable(np);
 
   release(&np->lock);
 
   return pid;
 }
 
+// Apply spawn()'s file actions to np's open files.
+static int
+spawnfiles(struct proc *np, struct spawnact *act, int nact)
+{
+  struct file *f, **ofile = np->files->ofile;
+  int i, fd, nfd;
+
+  for(i = 0; i < nact; i++){
+    fd = act[i].fd;
+    nfd = act[i].newfd;
+    if(fd < 0 || fd >= NOFILE)
+      return -1;
+    switch(act[i].op){
+    case SPAWN_CLOSE:
+      if(ofile[fd]){
+        fileclose(ofile[fd]);
+        ofile[fd] = 0;
+      }
+      break;
+    case SPAWN_DUP2:
+      if(nfd < 0 || nfd >= NOFILE || ofile[fd] == 0)
+        return -1;
+      if(nfd == fd)
+        break;
+      f = filedup(ofile[fd]);
+      if(ofile[nfd])
+        fileclose(ofile[nfd]);
+      ofile[nfd] = f;
+      break;
+    default:
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Create a new process running the program at path with
+// arguments argv, as fork() followed by exec() would, but
+// build its memory straight from the program file instead
+// of copying the caller's first. The child starts with the
+// caller's open files, changed by the nact actions in act.
+// Returns the child's pid, or -1.
+int
+spawn(char *path, char **argv, struct spawnact *act, int nact)
+{
+  int i, pid, argc;
+  struct proc *np;
+  struct proc *p = myproc();
+
+  if((np = allocproc(0)) == 0)
+    return -1;
+  // np is USED, so no one else will take it, and
+  // exec_image() must be able to sleep.
+  release(&np->lock);
+
+  memset(np->trapframe, 0, sizeof(*np->trapframe));
+  acquire(&p->files->lock);
+  for(i = 0; i < NOFILE; i++)
+    if(p->files->ofile[i])
+      np->files->ofile[i] = filedup(p->files->ofile[i]);
+  release(&p->files->lock);
+  np->cwd = idup(p->cwd);
+
+  if(spawnfiles(np, act, nact) < 0 ||
+     (argc = exec_image(np, path, argv)) < 0)
+    goto bad;
+  np->trapframe->a0 = argc;
+
+  acquire(&wait_lock);
+  adopt(p, np);
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  np->nice = np->prio = p->nice;
+  pid = np->pid;
+  setrunnable(np);
+  release(&np->lock);
+
+  return pid;
+
+ bad:
+  for(i = 0; i < NOFILE; i++){
+    if(np->files->ofile[i]){
+      fileclose(np->files->ofile[i]);
+      np->files->ofile[i] = 0;
+    }
+  }
+  begin_op();
+  iput(np->cwd);
+  end_op();
+  np->cwd = 0;
+  acquire(&np->lock);
+  freeproc(np);
+  release(&np->lock);
+  return -1;
+}
+
 // Pass p's abandoned children to init.
-// Caller must hold p->lock.
+// Caller must hold wait_lock.
 void
 reparent(struct proc *p)
 {
   struct proc *pp;
 
-  for(pp = proc; pp < &proc[NPROC]; pp++){
-    // this code uses pp->parent without holding pp->lock.
-    // acquiring the lock first could cause a deadlock
-    // if pp or a child of pp were also in exit()
-    // and about to try to lock p.
-    if(pp->parent == p){
-      // pp->parent can't change between the check and the acquire()
-      // because only the parent changes it, and we're the parent.
-      acquire(&pp->lock);
-      pp->parent = initproc;
-      // we should wake up init here, but that would require
-      // initproc->lock, which would be a deadlock, since we hold
-      // the lock on one of init's children (pp). this is why
-      // exit() always wakes init (before acquiring any locks).
-      release(&pp->lock);
-    }
+  if(p->children == 0)
+    return;
+  for(pp = p->children; ; pp = pp->sibling){
+    pp->parent = initproc;
+    if(pp->sibling == 0)
+      break;
   }
+  pp->sibling = initproc->children;
+  initproc->children = p->children;
+  p->children = 0;
+  // some may already be zombies.
+  wakeup(initproc);
 }
 
-// Exit the current process.  Does not return.
+// Exit the current process, or thread.  Does not return.
 // An exited process remains in the zombie state
-// until its parent calls wait().
+// until its parent calls wait(), or join() for a thread.
 void
 exit(int status)
 {
   struct proc *p = myproc();
+  int last;
 
   if(p == initproc)
     panic("init exiting");
 
-  // Close all open files.
-  for(int fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd]){
-      struct file *f = p->ofile[fd];
-      fileclose(f);
-      p->ofile[fd] = 0;
-    }
-  }
+  // the last thread out removes the mappings of files, which
+  // may sleep; the rest of the memory goes when the last one
+  // is freed (see freeproc()).
+  acquire(&p->mm->lock);
+  last = --p->mm->nthread == 0;
+  release(&p->mm->lock);
+  if(last)
+    munmapall(p);
+
+  // Close all open files, unless other threads still use them.
+  filesput(p);
+  p->files = 0;
 
   begin_op();
   iput(p->cwd);
   end_op();
   p->cwd = 0;
 
-  // we might re-parent a child to init. we can't be precise about
-  // waking up init, since we can't acquire its lock once we've
-  // acquired any other proc lock. so wake up init whether that's
-  // necessary or not. init may miss this wakeup, but that seems
-  // harmless.
-  acquire(&initproc->lock);
-  wakeup1(initproc);
-  release(&initproc->lock);
-
-  // grab a copy of p->parent, to ensure that we unlock the same
-  // parent we locked. in case our parent gives us away to init while
-  // we're waiting for the parent lock. we may then race with an
-  // exiting parent, but the result will be a harmless spurious wakeup
-  // to a dead or wrong process; proc structs are never re-allocated
-  // as anything else.
-  acquire(&p->lock);
-  struct proc *original_parent = p->parent;
-  release(&p->lock);
-  
-  // we need the parent's lock in order to wake it up from wait().
-  // the parent-then-child rule says we have to lock it first.
-  acquire(&original_parent->lock);
-
-  acquire(&p->lock);
+  acquire(&wait_lock);
 
   // Give any children to init.
   reparent(p);
 
   // Parent might be sleeping in wait().
-  wakeup1(original_parent);
+  wakeup(p->parent);
+
+  acquire(&p->lock);
 
   p->xstate = status;
   p->state = ZOMBIE;
+  p->nvcsw++;
 
-  release(&original_parent->lock);
+  release(&wait_lock);
 
   // Jump into the scheduler, never to return.
   sched();
   panic("zombie exit");
 }
 
-// Wait for a child process to exit and return its pid.
-// Return -1 if this process has no children.
-int
-wait(uint64 addr)
+// Wait for a child to exit, free it, and return its pid: a
+// child process if tid is 0, or else thread tid, which must
+// have been created by this thread.
+// Return -1 if there is no such child.
+static int
+waitchild(int tid, uint64 addr)
 {
-  struct proc *np;
+  struct proc *np, **pp;
   int havekids, pid;
   struct proc *p = myproc();
 
-  // hold p->lock for the whole time to avoid lost
+  // hold wait_lock for the whole time to avoid lost
   // wakeups from a child's exit().
-  acquire(&p->lock);
+  acquire(&wait_lock);
 
   for(;;){
-    // Scan through table looking for exited children.
+    // Scan through p's children looking for exited ones.
     havekids = 0;
-    for(np = proc; np < &proc[NPROC]; np++){
-      // this code uses np->parent without holding np->lock.
-      // acquiring the lock first would cause a deadlock,
-      // since np might be an ancestor, and we already hold p->lock.
-      if(np->parent == p){
-        // np->parent can't change between the check and the acquire()
-        // because only the parent changes it, and we're the parent.
-        acquire(&np->lock);
-        havekids = 1;
-        if(np->state == ZOMBIE){
-          // Found one.
-          pid = np->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&np->xstate,
-                                  sizeof(np->xstate)) < 0) {
-            release(&np->lock);
-            release(&p->lock);
-            return -1;
-          }
-          freeproc(np);
+    for(pp = &p->children; (np = *pp) != 0; pp = &np->sibling){
+      acquire(&np->lock);
+      // a thread shares p's mm, and is only for join().
+      if(tid ? np->pid != tid || np->mm != p->mm : np->mm == p->mm){
+        release(&np->lock);
+        continue;
+      }
+      havekids = 1;
+      if(np->state == ZOMBIE){
+        // Found one.
+        pid = np->pid;
+        if(addr != 0 && copyout(p->pagetable, addr, (char *)&np->xstate,
+                                sizeof(np->xstate)) < 0) {
           release(&np->lock);
-          release(&p->lock);
-          return pid;
+          release(&wait_lock);
+          return -1;
         }
+        *pp = np->sibling;
+        freeproc(np);
         release(&np->lock);
+        release(&wait_lock);
+        return pid;
       }
+      release(&np->lock);
     }
 
     // No point waiting if we don't have any children.
     if(!havekids || p->killed){
-      release(&p->lock);
+      release(&wait_lock);
       return -1;
     }
     
     // Wait for a child to exit.
-    sleep(p, &p->lock);  //DOC: wait-sleep
+    sleep(p, &wait_lock);  //DOC: wait-sleep
   }
 }
 
+// Wait for a child process to exit and return its pid.
+// Return -1 if this process has no children.
+int
+wait(uint64 addr)
+{
+  return waitchild(0, addr);
+}
+
+// Wait for thread tid, created by the current thread with
+// clone(), to exit, and free it.
+// Return tid, or -1 if there is no such thread.
+int
+join(int tid, uint64 addr)
+{
+  if(tid <= 0)
+    return -1;
+  return waitchild(tid, addr);
+}
+
+// Create a new thread of the current process, sharing its
+// memory and open files, that starts in fn(arg) with its
+// stack pointer at stack. fn must not return, but call
+// exit(). Returns the new thread's pid, or -1.
+int
+clone(uint64 fn, uint64 arg, uint64 stack)
+{
+  int tid;
+  struct proc *np;
+  struct proc *p = myproc();
+
+  if((np = allocproc(p)) == 0)
+    return -1;
+
+  *(np->trapframe) = *(p->trapframe);
+  np->trapframe->epc = fn;
+  np->trapframe->a0 = arg;
+  np->trapframe->sp = stack & ~0xfL;  // riscv sp must be 16-byte aligned
+  np->trapframe->ra = 0;
+  np->cwd = idup(p->cwd);
+
+  safestrcpy(np->name, p->name, sizeof(p->name));
+
+  np->nice = np->prio = p->nice;
+  tid = np->pid;
+  release(&np->lock);
+
+  acquire(&wait_lock);
+  adopt(p, np);
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  setrunnable(np);
+
+  release(&np->lock);
+
+  return tid;
+}
+
+// Lift p back to its nice level if it missed the latest
+// priboost() while not on a run queue.
+static void
+catchboost(struct proc *p)
+{
+  if(p->boost != boostepoch){
+    p->boost = boostepoch;
+    p->prio = p->nice;
+    p->slice = 0;
+  }
+}
+
+// The hart whose run queue p should go on: the one it last
+// ran on, else this one, else the first that p may run on.
+static int
+runqhome(struct proc *p)
+{
+  int id;
+
+  if(p->cpu >= 0 && (p->affinity & (1L << p->cpu)))
+    return p->cpu;
+  id = cpuid();
+  if(p->affinity & (1L << id))
+    return id;
+  for(id = 0; id < NCPU - 1; id++)
+    if(p->affinity & (1L << id))
+      break;
+  return id;
+}
+
+// Make p RUNNABLE and put it at the tail of its home
+// hart's run queue.
+// Caller must hold p->lock or, if p is SLEEPING,
+// its sleep queue's lock.
+static void
+setrunnable(struct proc *p)
+{
+  int id = runqhome(p);
+  struct runq *rq = &runqs[id];
+
+  catchboost(p);
+  p->state = RUNNABLE;
+  acquire(&rq->lock);
+  runqput(rq, p);
+  release(&rq->lock);
+  kickidle(id, p);
+}
+
+// Process p has just been queued on hart id. If that hart is
+// idle, interrupt it so that it runs p. If it is busy, and p
+// may run on an idle hart, interrupt that one instead, so
+// that it comes to steal p.
+// Caller has interrupts off.
+static void
+kickidle(int id, struct proc *p)
+{
+  struct cpu *c = &cpus[id];
+
+  if(c == mycpu() && c->proc == 0)
+    return;  // in scheduler(), which will find it.
+  __sync_synchronize();
+  if(c->idle && __sync_bool_compare_and_swap(&c->idle, 1, 0)){
+    if(c != mycpu())
+      sbi_send_ipi(id);
+    return;
+  }
+  for(c = cpus; c < &cpus[NCPU]; c++){
+    if((p->affinity & (1L << (c - cpus))) && c->idle &&
+       __sync_bool_compare_and_swap(&c->idle, 1, 0)){
+      sbi_send_ipi(c - cpus);
+      return;
+    }
+  }
+}
+
+// Append p to rq at level p->prio.
+// Caller must hold rq->lock.
+static void
+runqput(struct runq *rq, struct proc *p)
+{
+  p->rqnext = 0;
+  if(rq->tail[p->prio])
+    rq->tail[p->prio]->rqnext = p;
+  else
+    rq->head[p->prio] = p;
+  rq->tail[p->prio] = p;
+  rq->n++;
+}
+
+// Take the first process of the highest level of rq, down
+// to level maxprio, that hart id may run, or return 0.
+// A process on another hart's queue may be pinned there;
+// one on id's own queue might just have been pinned
+// elsewhere, so runqclaim() checks.
+static struct proc*
+runqpop(struct runq *rq, int id, int maxprio)
+{
+  struct proc *p = 0, *prev;
+
+  if(rq->n == 0)
+    return 0;
+  acquire(&rq->lock);
+  for(int i = 0; i <= maxprio; i++){
+    prev = 0;
+    for(p = rq->head[i]; p; prev = p, p = p->rqnext)
+      if(rq == &runqs[id] || (p->affinity & (1L << id)))
+        break;
+    if(p){
+      if(prev)
+        prev->rqnext = p->rqnext;
+      else
+        rq->head[i] = p->rqnext;
+      if(rq->tail[i] == p)
+        rq->tail[i] = prev;
+      rq->n--;
+      break;
+    }
+  }
+  release(&rq->lock);
+  return p;
+}
+
+// Lift every process back to its nice level.
+// Called from clockintr() every BOOSTTICKS ticks.
+void
+priboost(void)
+{
+  struct runq *rq;
+  struct proc *p, *list, *next, **tailp;
+  int i;
+
+  boostepoch++;
+  for(rq = runqs; rq < &runqs[NCPU]; rq++){
+    if(rq->n == 0)
+      continue;
+    acquire(&rq->lock);
+    // requeue in order of the old levels.
+    list = 0;
+    tailp = &list;
+    for(i = 0; i < NPRIO; i++){
+      *tailp = rq->head[i];
+      if(rq->tail[i])
+        tailp = &rq->tail[i]->rqnext;
+      rq->head[i] = rq->tail[i] = 0;
+    }
+    *tailp = 0;
+    rq->n = 0;
+    for(p = list; p; p = next){
+      next = p->rqnext;
+      p->boost = boostepoch;
+      p->prio = p->nice;
+      p->slice = 0;
+      runqput(rq, p);
+    }
+    release(&rq->lock);
+  }
+}
+
+// Charge a timer tick to the current process.
+// Returns 1 if it should yield(): it has used up its
+// time slice, and so drops a level, or a process of
+// higher priority is waiting on this hart.
+// Caller has interrupts off.
+int
+schedtick(void)
+{
+  struct proc *p = myproc();
+  struct runq *rq = &runqs[cpuid()];
+
+  p->ticks++;
+  catchboost(p);
+  if(++p->slice >= QUANTUM(p->prio)){
+    p->slice = 0;
+    if(p->prio < NPRIO-1)
+      p->prio++;
+    return 1;
+  }
+  for(int i = 0; i < p->prio; i++)
+    if(rq->head[i])
+      return 1;
+  return 0;
+}
+
+// Take a process of level maxprio or better for hart id
+// to run off a run queue: the next one on its own, or else
+// one stolen from another hart. Returns 0 if there is none.
+static struct proc*
+runqtake(int id, int maxprio)
+{
+  struct proc *p = 0;
+
+  for(int i = 0; i < NCPU && p == 0; i++)
+    p = runqpop(&runqs[(id + i) % NCPU], id, maxprio);
+  return p;
+}
+
+// Lock p, which runqtake() returned, for hart id to run.
+// Returns p, or 0 if p has been pinned elsewhere since it
+// was queued here, in which case it is queued again.
+static struct proc*
+runqclaim(struct proc *p, int id)
+{
+  // The process may still be on its way out of another
+  // hart's sched(); acquiring its lock waits for that.
+  acquire(&p->lock);
+  if(p->state != RUNNABLE)
+    panic("runqclaim: not runnable");
+  if((p->affinity & (1L << id)) == 0){
+    setrunnable(p);
+    release(&p->lock);
+    return 0;
+  }
+  return p;
+}
+
+// runqtake() and then runqclaim(): the process hart id
+// should run next, locked, or 0.
+// Caller has interrupts off.
+static struct proc*
+runqnext(int id, int maxprio)
+{
+  struct proc *p;
+
+  if((p = runqtake(id, maxprio)) == 0)
+    return 0;
+  return runqclaim(p, id);
+}
+
+// Make p, which runqclaim() returned, the process running
+// on hart c, and switch to its kernel page table. The
+// caller then swtch()es to p->context.
+static void
+switchin(struct cpu *c, struct proc *p)
+{
+  int id = c - cpus;
+
+  if(p->cpu != id){
+    if(p->cpu >= 0)
+      p->nmigrate++;
+    p->cpu = id;
+  }
+  p->state = RUNNING;
+  c->proc = p;
+  w_satp(MAKE_SATP(p->kpagetable));
+  sfence_vma();
+}
+
+// Called by a process just switched in: if yield() switched
+// straight here from c->prev, put that process on a run
+// queue and release its lock, as scheduler() would have.
+static void
+finishswitch(struct cpu *c)
+{
+  struct proc *p = c->prev;
+
+  if(p){
+    c->prev = 0;
+    setrunnable(p);
+    release(&p->lock);
+  }
+}
+
+// Has hart id nothing to run? Processes on other harts'
+// queues that may not run on id don't count.
+static int
+runqidle(int id)
+{
+  struct runq *rq;
+  struct proc *p;
+  int i, found = 0;
+
+  if(runqs[id].n > 0)
+    return 0;
+  for(rq = runqs; rq < &runqs[NCPU] && !found; rq++){
+    if(rq->n == 0)
+      continue;
+    acquire(&rq->lock);
+    for(i = 0; i < NPRIO && !found; i++)
+      for(p = rq->head[i]; p && !found; p = p->rqnext)
+        found = (p->affinity & (1L << id)) != 0;
+    release(&rq->lock);
+  }
+  return !found;
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
@@ -458,35 +1368,57 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int id = c - cpus;
   
   c->proc = 0;
+  __sync_fetch_and_or(&cpumask, 1L << id);
   for(;;){
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
     
-    int found = 0;
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-
-        found = 1;
+    if((p = runqtake(id, NPRIO-1)) == 0){
+      // nothing to run: get a page zeroed for later
+      // kzalloc() calls, or else wait for an interrupt.
+      // look at the queues again with interrupts off, so
+      // that an interrupt that makes a process RUNNABLE
+      // can't slip in between the check and the wfi;
+      // a pending interrupt still ends the wfi. c->idle
+      // asks other harts to interrupt this one when they
+      // queue a process. the timer is needed only for the
+      // next sleep() deadline.
+      if(kzerofill() == 0){
+        intr_off();
+        c->idle = 1;
+        __sync_synchronize();
+        if(runqidle(c - cpus)){
+          timeridle();
+          asm volatile("wfi");
+        }
+        c->idle = 0;
       }
-      release(&p->lock);
-    }
-    if(found == 0) {
-      intr_on();
-      asm volatile("wfi");
+      continue;
     }
+
+    // arm the timer for p's time slice before taking p->lock:
+    // timerbusy() takes the wheel lock, which timersleep()
+    // takes before a process's lock.
+    timerbusy();
+    if((p = runqclaim(p, id)) == 0)
+      continue;
+
+    // Switch to chosen process.  It is the process's job
+    // to release its lock and then reacquire it
+    // before jumping back to us.
+    switchin(c, p);
+    swtch(&c->context, &p->context);
+    kvminithart();
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    // It may not be p, if p yield()ed straight to another.
+    p = c->proc;
+    c->proc = 0;
+    release(&p->lock);
   }
 }
 
@@ -515,16 +1447,49 @@ sched(void)
   intena = mycpu()->intena;
   swtch(&p->context, &mycpu()->context);
   mycpu()->intena = intena;
+  finishswitch(mycpu());
 }
 
 // Give up the CPU for one scheduling round.
+// Rather than going through scheduler(), which costs a
+// second swtch(), switch straight to the process this hart
+// would run next, or keep running if there is none at p's
+// level or better. p goes on a run queue only once it is
+// off this hart's stack, by finishswitch(): so no other
+// hart can be waiting for p->lock while this one waits for
+// the next process's.
 void
 yield(void)
 {
-  struct proc *p = myproc();
+  struct proc *p = myproc(), *np;
+  struct cpu *c;
+  int intena;
+
   acquire(&p->lock);
+  c = mycpu();
+  catchboost(p);
+  if((p->affinity & (1L << (c - cpus))) == 0){
+    // pinned elsewhere: scheduler() will move it.
+    setrunnable(p);
+    p->nivcsw++;
+    sched();
+    release(&p->lock);
+    return;
+  }
+  if((np = runqnext(c - cpus, p->prio)) == 0){
+    release(&p->lock);
+    return;
+  }
+
   p->state = RUNNABLE;
-  sched();
+  p->nivcsw++;
+  c->prev = p;
+  intena = c->intena;
+  switchin(c, np);
+  swtch(&p->context, &np->context);
+  c = mycpu();
+  c->intena = intena;
+  finishswitch(c);
   release(&p->lock);
 }
 
@@ -535,7 +1500,8 @@ forkret(void)
 {
   static int first = 1;
 
-  // Still holding p->lock from scheduler.
+  // Still holding p->lock from scheduler() or yield().
+  finishswitch(mycpu());
   release(&myproc()->lock);
 
   if (first) {
@@ -555,22 +1521,37 @@ void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct sleepq *sq = sleepq(chan);
   
   // Must acquire p->lock in order to
   // change p->state and then call sched.
-  // Once we hold p->lock, we can be
+  // Once p is on chan's sleep queue, we can be
   // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
+  // (wakeup locks the sleep queue),
   // so it's okay to release lk.
-  if(lk != &p->lock){  //DOC: sleeplock0
+  if(lk != &p->lock)  //DOC: sleeplock0
     acquire(&p->lock);  //DOC: sleeplock1
-    release(lk);
-  }
 
   // Go to sleep.
+  acquire(&sq->lock);
   p->chan = chan;
   p->state = SLEEPING;
+  p->sqnext = 0;
+  p->sqprev = sq->tail;
+  if(sq->tail)
+    sq->tail->sqnext = p;
+  else
+    sq->head = p;
+  sq->tail = p;
+  release(&sq->lock);
+
+  if(lk != &p->lock)
+    release(lk);
 
+  // A wakeup may already have made p RUNNABLE; another
+  // hart can't run it until sched() is done with p->lock.
+  // Either way this switch is voluntary.
+  p->nvcsw++;
   sched();
 
   // Tidy up.
@@ -583,32 +1564,74 @@ sleep(void *chan, struct spinlock *lk)
   }
 }
 
+// Take p off its sleep queue sq and make it RUNNABLE.
+// Caller must hold sq->lock.
+static void
+unsleep(struct sleepq *sq, struct proc *p)
+{
+  if(p->sqprev)
+    p->sqprev->sqnext = p->sqnext;
+  else
+    sq->head = p->sqnext;
+  if(p->sqnext)
+    p->sqnext->sqprev = p->sqprev;
+  else
+    sq->tail = p->sqprev;
+  setrunnable(p);
+}
+
+// Wake up at most n processes sleeping on chan,
+// the ones that have slept longest first.
+// Returns the number woken.
+int
+wakeupn(void *chan, int n)
+{
+  struct sleepq *sq = sleepq(chan);
+  struct proc *p, *next;
+  int woken = 0;
+
+  acquire(&sq->lock);
+  for(p = sq->head; p && woken < n; p = next){
+    next = p->sqnext;
+    if(p->chan == chan){
+      unsleep(sq, p);
+      woken++;
+    }
+  }
+  release(&sq->lock);
+  return woken;
+}
+
 // Wake up all processes sleeping on chan.
-// Must be called without any p->lock.
 void
 wakeup(void *chan)
 {
-  struct proc *p;
+  wakeupn(chan, NPROC);
+}
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    acquire(&p->lock);
-    if(p->state == SLEEPING && p->chan == chan) {
-      p->state = RUNNABLE;
-    }
-    release(&p->lock);
-  }
+// Wake up the process that has slept longest on chan,
+// for a resource that only one process can use; it should
+// in turn wake the next one if it leaves some behind.
+void
+wakeup_one(void *chan)
+{
+  wakeupn(chan, 1);
 }
 
-// Wake up p if it is sleeping in wait(); used by exit().
-// Caller must hold p->lock.
+// Wake p if it is SLEEPING, whatever the channel.
+// Caller must hold p->lock, which keeps p->chan steady.
 static void
-wakeup1(struct proc *p)
+wakeproc(struct proc *p)
 {
-  if(!holding(&p->lock))
-    panic("wakeup1");
-  if(p->chan == p && p->state == SLEEPING) {
-    p->state = RUNNABLE;
-  }
+  struct sleepq *sq;
+
+  if(p->state != SLEEPING)
+    return;
+  sq = sleepq(p->chan);
+  acquire(&sq->lock);
+  if(p->state == SLEEPING)
+    unsleep(sq, p);
+  release(&sq->lock);
 }
 
 // Kill the process with the given pid.
@@ -619,20 +1642,94 @@ kill(int pid)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++){
-    acquire(&p->lock);
-    if(p->pid == pid){
-      p->killed = 1;
-      if(p->state == SLEEPING){
-        // Wake process from sleep().
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
-      return 0;
-    }
-    release(&p->lock);
-  }
-  return -1;
+  if((p = findproc(pid)) == 0)
+    return -1;
+  p->killed = 1;
+  // Wake process from sleep().
+  wakeproc(p);
+  release(&p->lock);
+  return 0;
+}
+
+// Set the level that process pid starts at, and goes back
+// to at each boost, to nice (0 is the highest priority);
+// pid 0 means the caller. It takes effect at the process's
+// next tick or wakeup. Returns the old level, or -1.
+int
+setpriority(int pid, int nice)
+{
+  struct proc *p;
+  int old;
+
+  if(nice < 0 || nice >= NPRIO)
+    return -1;
+  if(pid == 0)
+    pid = myproc()->pid;
+  if((p = findproc(pid)) == 0)
+    return -1;
+  old = p->nice;
+  p->nice = nice;
+  p->boost = boostepoch - 1;
+  release(&p->lock);
+  return old;
+}
+
+// Allow process pid (0 means the caller) to run only on the
+// harts in mask. Harts that aren't running are left out.
+// Returns 0, or -1 if there is no such process or the mask
+// leaves no hart.
+int
+setaffinity(int pid, uint64 mask)
+{
+  struct proc *p;
+  int id;
+
+  mask &= cpumask;
+  if(mask == 0)
+    return -1;
+  if(pid == 0)
+    pid = myproc()->pid;
+  if((p = findproc(pid)) == 0)
+    return -1;
+  p->affinity = mask;
+  release(&p->lock);
+
+  // a process running elsewhere moves when it next gives up
+  // its hart; the caller moves now.
+  push_off();
+  id = cpuid();
+  pop_off();
+  if(p == myproc() && (mask & (1L << id)) == 0)
+    yield();
+  return 0;
+}
+
+// Copy scheduling statistics of process pid (0 means the
+// caller) to the struct procstat at user address addr.
+// Returns 0, or -1 if there is no such process.
+int
+procstat(int pid, uint64 addr)
+{
+  struct proc *p;
+  struct procstat st;
+
+  if(pid == 0)
+    pid = myproc()->pid;
+  if((p = findproc(pid)) == 0)
+    return -1;
+  st.pid = p->pid;
+  safestrcpy(st.state, procstates[p->state], sizeof(st.state));
+  safestrcpy(st.name, p->name, sizeof(st.name));
+  st.prio = p->prio;
+  st.nice = p->nice;
+  st.ticks = p->ticks;
+  st.nvcsw = p->nvcsw;
+  st.nivcsw = p->nivcsw;
+  st.affinity = p->affinity;
+  st.cpu = p->cpu;
+  st.nmigrate = p->nmigrate;
+  release(&p->lock);
+  return copyout(myproc()->pagetable, addr, (char*)&st, sizeof(st));
 }
 
 // Copy to either a user address, or kernel address,
@@ -671,25 +1768,21 @@ either_copyin(void *dst, int user_src, uint64 src, uint64 len)
 void
 procdump(void)
 {
-  static char *states[] = {
-  [UNUSED]    "unused",
-  [SLEEPING]  "sleep ",
-  [RUNNABLE]  "runble",
-  [RUNNING]   "run   ",
-  [ZOMBIE]    "zombie"
-  };
   struct proc *p;
   char *state;
 
   printf("\n");
-  for(p = proc; p < &proc[NPROC]; p++){
+  for(p = allproc; p; p = p->nextproc){
     if(p->state == UNUSED)
       continue;
-    if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
-      state = states[p->state];
+    if(p->state >= 0 && p->state < NELEM(procstates) && procstates[p->state])
+      state = procstates[p->state];
     else
       state = "???";
     printf("%d %s %s", p->pid, state, p->name);
+    printf(" prio %d nice %d ticks %d csw %d/%d", p->prio, p->nice,
+           p->ticks, p->nvcsw, p->nivcsw);
+    printf(" cpu %d mig %d", p->cpu, p->nmigrate);
     printf("\n");
   }
 }
@@ -24,6 +24,11 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  uint64 timer;               // Time of the next timer interrupt, or -1
+  int idle;                   // Waiting in scheduler() for a process?
+  struct proc *prev;          // Locked, switched out by yield(); see finishswitch()
+  uint flushreq;              // TLB flushes asked for (see shootdown())
+  uint flushdone;             // flushreq as of the last one done
 };
 
 extern struct cpu cpus[NCPU];
@@ -80,7 +85,38 @@ struct trapframe {
   /* 280 */ uint64 t6;
 };
 
-enum procstate { UNUSED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
+// a region of a process's memory mapped from a file by mmap().
+struct vma {
+  uint64 addr;                 // page-aligned start
+  uint64 len;                  // bytes, a multiple of PGSIZE
+  int prot;                    // PROT_ flags
+  int flags;                   // MAP_SHARED or MAP_PRIVATE
+  struct file *f;              // the file; 0 if this vma is free
+  uint off;                    // file offset mapped at addr
+};
+
+// a user address space, shared by the threads of a
+// process (see clone()).
+struct mm {
+  struct spinlock lock;        // protects the page table and the fields below
+  int mapping;                 // a thread is changing sz or vma[] (see mapbegin())
+  int ref;                     // procs using this mm, including zombies
+  int nthread;                 // of those, ones that haven't exited
+  uint64 tfmask;               // trapframe slots in use (see TRAPFRAMEK())
+  pagetable_t pagetable;       // User page table
+  uint64 sz;                   // Size of process memory (bytes)
+  uint64 guard;                // User stack guard page, or MMAPTOP if none
+  struct vma vma[NVMA];        // Memory-mapped files
+};
+
+// open files, shared by the threads of a process.
+struct files {
+  struct spinlock lock;        // held while installing or clearing an fd
+  int ref;
+  struct file *ofile[NOFILE];  // Open files
+};
+
+enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
 struct proc {
@@ -88,19 +124,43 @@ struct proc {
 
   // p->lock must be held when using these:
   enum procstate state;        // Process state
-  struct proc *parent;         // Parent process
   void *chan;                  // If non-zero, sleeping on chan
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int nice;                    // Highest priority level (see setpriority())
+  uint64 affinity;             // Harts it may run on, one bit each
+  int cpu;                     // Hart it last ran on, or -1
+  uint nmigrate;               // Times it ran on a different hart than last
+
+  // wait_lock must be held when using these:
+  struct proc *parent;         // Parent process
+  struct proc *children;       // Children, newest first
+  struct proc *sibling;        // Next in parent->children
 
   // these are private to the process, so p->lock need not be held.
+  struct proc *nextproc;       // Next in allproc; fixed once set
+  struct proc *pidnext;        // Next in pid hash bucket; under its lock
+  struct proc *rqnext;         // Next on a run queue; under its lock
+  struct proc *sqnext;         // Sleep queue links; under its lock
+  struct proc *sqprev;
+
+  // scheduling state, changed by the process itself with
+  // interrupts off, or under a run queue's lock while queued.
+  int prio;                    // Current level, 0 (highest) to NPRIO-1
+  int slice;                   // Ticks used at this level
+  uint boost;                  // Last boost applied to prio
+  uint ticks;                  // Timer ticks spent running
+  uint nvcsw;                  // Voluntary context switches (sleep, exit)
+  uint nivcsw;                 // Involuntary ones (preemption)
   uint64 kstack;               // Virtual address of kernel stack
-  uint64 sz;                   // Size of process memory (bytes)
-  pagetable_t pagetable;       // User page table
+  struct mm *mm;               // User memory, maybe shared with other threads
+  pagetable_t pagetable;       // User page table, mm->pagetable
+  pagetable_t kpagetable;      // Kernel page table, with user memory
   struct trapframe *trapframe; // data page for trampoline.S
+  uint64 tfva;                 // user address of trapframe
   struct context context;      // swtch() here to run process
-  struct file *ofile[NOFILE];  // Open files
+  struct files *files;         // Open files, maybe shared with other threads
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
 };
@@ -0,0 +1,14 @@
+// Scheduling statistics of a process, from procstat().
+struct procstat {
+  int pid;
+  char state[8];               // as in procdump()
+  char name[16];
+  int prio;                    // current level, 0 (highest) to NPRIO-1
+  int nice;                    // level it returns to at each boost
+  uint ticks;                  // timer ticks spent running
+  uint nvcsw;                  // voluntary context switches
+  uint nivcsw;                 // involuntary context switches
+  uint64 affinity;             // harts it may run on, one bit each
+  int cpu;                     // hart it last ran on, or -1
+  uint nmigrate;               // moves to a different hart
+};
@@ -44,6 +44,7 @@ w_mepc(uint64 x)
 #define SSTATUS_SPIE (1L << 5) // Supervisor Previous Interrupt Enable
 #define SSTATUS_UPIE (1L << 4) // User Previous Interrupt Enable
 #define SSTATUS_SIE (1L << 1)  // Supervisor Interrupt Enable
+#define SSTATUS_SUM (1L << 18) // Supervisor may access User Memory
 #define SSTATUS_UIE (1L << 0)  // User Interrupt Enable
 
 static inline uint64
@@ -234,6 +235,8 @@ r_stval()
 }
 
 // Machine-mode Counter-Enable
+#define MCOUNTEREN_CY (1L << 0) // supervisor may read cycle
+#define MCOUNTEREN_TM (1L << 1) // supervisor may read time
 static inline void 
 w_mcounteren(uint64 x)
 {
@@ -248,6 +251,23 @@ r_mcounteren()
   return x;
 }
 
+// Supervisor-mode Counter-Enable
+#define SCOUNTEREN_CY (1L << 0) // user may read cycle
+#define SCOUNTEREN_TM (1L << 1) // user may read time
+static inline void 
+w_scounteren(uint64 x)
+{
+  asm volatile("csrw scounteren, %0" : : "r" (x));
+}
+
+static inline uint64
+r_scounteren()
+{
+  uint64 x;
+  asm volatile("csrr %0, scounteren" : "=r" (x) );
+  return x;
+}
+
 // machine-mode cycle counter
 static inline uint64
 r_time()
@@ -257,6 +277,30 @@ r_time()
   return x;
 }
 
+// requests from supervisor mode to timervec in kernelvec.S,
+// made with ecall: a7 is the function, a0 the argument.
+#define SBI_SET_TIMER 0
+#define SBI_SEND_IPI  1
+
+// ask for a timer interrupt on this hart once time
+// reaches when, replacing any earlier request.
+static inline void
+sbi_set_timer(uint64 when)
+{
+  register uint64 a0 asm("a0") = when;
+  register uint64 a7 asm("a7") = SBI_SET_TIMER;
+  asm volatile("ecall" : : "r" (a0), "r" (a7) : "memory");
+}
+
+// raise a supervisor software interrupt on hart.
+static inline void
+sbi_send_ipi(int hart)
+{
+  register uint64 a0 asm("a0") = hart;
+  register uint64 a7 asm("a7") = SBI_SEND_IPI;
+  asm volatile("ecall" : : "r" (a0), "r" (a7) : "memory");
+}
+
 // enable device interrupts
 static inline void
 intr_on()
@@ -326,11 +370,18 @@ sfence_vma()
 #define PGROUNDUP(sz)  (((sz)+PGSIZE-1) & ~(PGSIZE-1))
 #define PGROUNDDOWN(a) (((a)) & ~(PGSIZE-1))
 
+#define MPGSIZE (512*PGSIZE) // bytes per megapage (a level-1 leaf)
+#define MPGROUNDDOWN(a) (((a)) & ~(MPGSIZE-1))
+
 #define PTE_V (1L << 0) // valid
 #define PTE_R (1L << 1)
 #define PTE_W (1L << 2)
 #define PTE_X (1L << 3)
 #define PTE_U (1L << 4) // 1 -> user can access
+#define PTE_A (1L << 6) // accessed
+#define PTE_D (1L << 7) // dirty
+#define PTE_COW (1L << 8) // copy-on-write; uses an RSW bit
+#define PTE_MEGA (1L << 9) // leaf at level 1, maps a megapage; RSW bit
 
 // shift a physical address to the right place for a PTE.
 #define PA2PTE(pa) ((((uint64)pa) >> 12) << 10)
@@ -0,0 +1,211 @@
+// Slab allocator: caches of equal-sized kernel objects.
+//
+// Pipes, open files, in-memory inodes and procs are much
+// smaller than a page. A kmem_cache carves pages from
+// kalloc() into slabs of objects of one size, so that many
+// objects share a page. Freed objects are kept in their
+// constructed state, so the constructor (which typically
+// initializes locks) runs once per object rather than once
+// per allocation.
+//
+// Each hart has a small magazine of free objects for every
+// cache. kmem_cache_alloc() and kmem_cache_free() take the
+// cache's lock only when their hart's magazine is empty or
+// full, and then move MAGSIZE/2 objects at a time.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define NKMEMCACHE 8   // maximum number of caches
+#define MAGSIZE    8   // free objects in a hart's magazine
+
+// header at the start of each one-page slab.
+// objects follow it, each trailed by a link word
+// (so the link doesn't clobber the constructed object).
+struct slab {
+  struct slab *next;         // cache's list of slabs with free objects
+  struct slab *prev;
+  int inuse;                 // objects not on the slab's free list
+  void *freelist;            // free objects in this slab
+};
+
+#define SLABHDR  ((sizeof(struct slab) + 15) & ~15)
+#define LINK(c, obj) (*(void**)((char*)(obj) + (c)->size))
+
+struct magazine {
+  int n;
+  void *objs[MAGSIZE];
+};
+
+struct kmem_cache {
+  char *name;
+  uint size;                 // object size, rounded up to 8 bytes
+  uint perslab;              // objects per slab
+  void (*ctor)(void*);
+  struct spinlock lock;      // protects the slab lists
+  struct slab *partial;      // slabs with at least one free object
+  int nempty;                // slabs on partial with no objects in use
+  struct magazine mag[NCPU]; // per-hart magazines, used with intr off
+};
+
+static struct kmem_cache caches[NKMEMCACHE];
+static int ncaches;
+
+// Create a cache of objects of the given size.
+// ctor, if not 0, is called once on each new object.
+// Only called during boot, before other harts start.
+struct kmem_cache*
+kmem_cache_create(char *name, uint size, void (*ctor)(void*))
+{
+  struct kmem_cache *c;
+
+  if(ncaches >= NKMEMCACHE)
+    panic("kmem_cache_create: too many caches");
+  size = (size + 7) & ~7;
+  if(SLABHDR + size + sizeof(void*) > PGSIZE)
+    panic("kmem_cache_create: object too big");
+
+  c = &caches[ncaches++];
+  c->name = name;
+  c->size = size;
+  c->perslab = (PGSIZE - SLABHDR) / (size + sizeof(void*));
+  c->ctor = ctor;
+  initlock(&c->lock, name);
+  return c;
+}
+
+// Carve a fresh page into constructed objects and
+// put it on the cache's partial list.
+// Caller must hold c->lock.
+static struct slab*
+slab_grow(struct kmem_cache *c)
+{
+  struct slab *s;
+  char *obj;
+
+  if((s = (struct slab*)kalloc()) == 0)
+    return 0;
+  s->inuse = 0;
+  s->freelist = 0;
+  obj = (char*)s + SLABHDR + (c->perslab - 1) * (c->size + sizeof(void*));
+  for(; obj >= (char*)s + SLABHDR; obj -= c->size + sizeof(void*)){
+    if(c->ctor)
+      c->ctor(obj);
+    LINK(c, obj) = s->freelist;
+    s->freelist = obj;
+  }
+
+  s->prev = 0;
+  s->next = c->partial;
+  if(s->next)
+    s->next->prev = s;
+  c->partial = s;
+  c->nempty++;
+  return s;
+}
+
+static void
+slab_unlink(struct kmem_cache *c, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    c->partial = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+}
+
+// Fill half of magazine m from the slabs.
+// Caller has interrupts off.
+static void
+mag_refill(struct kmem_cache *c, struct magazine *m)
+{
+  struct slab *s;
+  void *obj;
+
+  acquire(&c->lock);
+  while(m->n < MAGSIZE/2){
+    if((s = c->partial) == 0 && (s = slab_grow(c)) == 0)
+      break;
+    obj = s->freelist;
+    s->freelist = LINK(c, obj);
+    if(s->inuse++ == 0)
+      c->nempty--;
+    if(s->freelist == 0)
+      slab_unlink(c, s);
+    m->objs[m->n++] = obj;
+  }
+  release(&c->lock);
+}
+
+// Return n objects from magazine m to their slabs,
+// giving completely free slabs back to kalloc()
+// beyond the first.
+// Caller has interrupts off.
+static void
+mag_flush(struct kmem_cache *c, struct magazine *m, int n)
+{
+  struct slab *s;
+  void *obj;
+
+  acquire(&c->lock);
+  while(n-- > 0 && m->n > 0){
+    obj = m->objs[--m->n];
+    s = (struct slab*)PGROUNDDOWN((uint64)obj);
+    if(s->freelist == 0){
+      s->prev = 0;
+      s->next = c->partial;
+      if(s->next)
+        s->next->prev = s;
+      c->partial = s;
+    }
+    LINK(c, obj) = s->freelist;
+    s->freelist = obj;
+    if(--s->inuse == 0){
+      if(c->nempty > 0){
+        slab_unlink(c, s);
+        kfree((void*)s);
+      } else {
+        c->nempty++;
+      }
+    }
+  }
+  release(&c->lock);
+}
+
+// Allocate an object from cache c.
+// Returns 0 if memory is exhausted.
+void*
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  struct magazine *m;
+  void *obj = 0;
+
+  push_off();
+  m = &c->mag[cpuid()];
+  if(m->n == 0)
+    mag_refill(c, m);
+  if(m->n > 0)
+    obj = m->objs[--m->n];
+  pop_off();
+  return obj;
+}
+
+// Return an object to cache c. The object must be in the
+// state the constructor left it in (e.g. locks released).
+void
+kmem_cache_free(struct kmem_cache *c, void *obj)
+{
+  struct magazine *m;
+
+  push_off();
+  m = &c->mag[cpuid()];
+  if(m->n == MAGSIZE)
+    mag_flush(c, m, MAGSIZE/2);
+  m->objs[m->n++] = obj;
+  pop_off();
+}
@@ -36,7 +36,9 @@ releasesleep(struct sleeplock *lk)
   acquire(&lk->lk);
   lk->locked = 0;
   lk->pid = 0;
-  wakeup(lk);
+  // the woken process takes the lock, and wakes
+  // the next waiter when it releases it.
+  wakeup_one(lk);
   release(&lk->lk);
 }
 
@@ -0,0 +1,12 @@
+// File actions for spawn(), applied in order to
+// the child's copy of the parent's open files.
+#define SPAWN_CLOSE 1   // close(fd)
+#define SPAWN_DUP2  2   // close(newfd), then make newfd a copy of fd
+
+#define MAXSPAWNACT 16  // max actions per spawn()
+
+struct spawnact {
+  int op;
+  int fd;
+  int newfd;
+};
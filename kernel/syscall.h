@@ -20,3 +20,16 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_spawn  22
+#define SYS_mmap   23
+#define SYS_munmap 24
+#define SYS_setpriority 25
+#define SYS_procstat 26
+#define SYS_nanosleep 27
+#define SYS_clone  28
+#define SYS_join   29
+#define SYS_futex_wait 30
+#define SYS_futex_wake 31
+#define SYS_sched_setaffinity 32
+#define SYS_sched_yield 33
+#define SYS_bcachestat 34
@@ -0,0 +1,237 @@
+// Timers for sleeping processes, kept in a hierarchical
+// timer wheel, so that a timer interrupt looks only at
+// timers that are due.
+//
+// Time is the time CSR (see r_time()). Level k of the wheel
+// has NSLOT slots, each covering WIDTH(k) = 2^SHIFT(k) units
+// of time, so each level spans one slot of the level above.
+// A timer goes in the lowest level whose span covers its
+// deadline, in the slot for the deadline. When the wheel's
+// clock reaches the start of a level-k slot's period, the
+// slot is "cascaded": its timers are re-added, and so move
+// down to finer levels. Timers in the current level-0 slot
+// fire once their deadline has passed.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+#define NLEVEL 4
+#define NSLOT  64
+#define SHIFT(k) (14 + 6*(k))  // level 0 slots are about 1.6ms in qemu
+#define WIDTH(k) (1L << SHIFT(k))
+#define SLOT(k, t) (((t) >> SHIFT(k)) & (NSLOT-1))
+
+struct timer {
+  uint64 when;                 // deadline, in time CSR units
+  int level;                   // level of the wheel it is on
+  struct timer **slot;         // list it is on
+  struct timer *next;
+  struct timer *prev;
+  int fired;                   // deadline has passed
+};
+
+struct {
+  struct spinlock lock;
+  uint64 now;                  // timers due before now have fired; WIDTH(0)-aligned
+  int n[NLEVEL];               // timers on each level
+  struct timer *slot[NLEVEL][NSLOT];
+} wheel;
+
+void
+timerinit(void)
+{
+  initlock(&wheel.lock, "timer");
+  wheel.now = r_time() & ~(WIDTH(0) - 1);
+}
+
+// Put t on the wheel.
+// Caller must hold wheel.lock.
+static void
+timeradd(struct timer *t)
+{
+  uint64 delta, when;
+  int k;
+
+  when = t->when < wheel.now ? wheel.now : t->when;
+  delta = when - wheel.now;
+  for(k = 0; k < NLEVEL-1; k++)
+    if(delta < WIDTH(k+1))
+      break;
+  if(delta >= WIDTH(k+1)){
+    // further away than the wheel reaches: park it in the
+    // top level's last slot, whose cascade will re-add it.
+    when = wheel.now + WIDTH(k+1) - WIDTH(k);
+  }
+
+  t->level = k;
+  t->slot = &wheel.slot[k][SLOT(k, when)];
+  t->prev = 0;
+  t->next = *t->slot;
+  if(t->next)
+    t->next->prev = t;
+  *t->slot = t;
+  wheel.n[k]++;
+}
+
+// Take t off the wheel.
+// Caller must hold wheel.lock.
+static void
+timerdel(struct timer *t)
+{
+  if(t->prev)
+    t->prev->next = t->next;
+  else
+    *t->slot = t->next;
+  if(t->next)
+    t->next->prev = t->prev;
+  wheel.n[t->level]--;
+}
+
+// Re-add the timers in level k's slot for the current time.
+// Caller must hold wheel.lock.
+static void
+cascade(int k)
+{
+  struct timer *t, *next;
+  struct timer **slot = &wheel.slot[k][SLOT(k, wheel.now)];
+
+  t = *slot;
+  *slot = 0;
+  for(; t; t = next){
+    next = t->next;
+    wheel.n[k]--;
+    timeradd(t);
+  }
+}
+
+// Fire the timers in the current level-0 slot that are
+// due by time now.
+// Caller must hold wheel.lock.
+static void
+expire(uint64 now)
+{
+  struct timer *t, *next;
+
+  for(t = wheel.slot[0][SLOT(0, wheel.now)]; t; t = next){
+    next = t->next;
+    if(t->when <= now){
+      timerdel(t);
+      t->fired = 1;
+      wakeup(t);
+    }
+  }
+}
+
+// Move the wheel's clock up to time now, firing every timer
+// that is due. The wheel may not have moved for a long time
+// (no timer interrupts come while harts are idle), so runs of
+// slots with nothing to do are skipped.
+// Caller must hold wheel.lock.
+static void
+advance(uint64 now)
+{
+  uint64 next;
+  int k;
+
+  for(;;){
+    expire(now);
+    if(now < wheel.now + WIDTH(0))
+      break;
+
+    // move to the next level-0 slot or, if the lower levels
+    // are empty, to the next point where a cascade might
+    // bring timers down to them; but not beyond now.
+    next = wheel.now + WIDTH(0);
+    for(k = 0; k < NLEVEL-1 && wheel.n[k] == 0; k++)
+      next = (wheel.now | (WIDTH(k+1) - 1)) + 1;
+    if(k == NLEVEL-1 && wheel.n[k] == 0)
+      next = now;
+    if(next > now)
+      next = now;
+    wheel.now = next & ~(WIDTH(0) - 1);
+
+    for(k = NLEVEL-1; k > 0; k--)
+      if((wheel.now & (WIDTH(k) - 1)) == 0)
+        cascade(k);
+  }
+}
+
+// Fire every timer that is due by time now.
+// Called on timer interrupts.
+void
+timerexpire(uint64 now)
+{
+  acquire(&wheel.lock);
+  advance(now);
+  release(&wheel.lock);
+}
+
+// The earliest time at which timerexpire() may have
+// something to do, or -1 if there are no timers.
+uint64
+timernext(void)
+{
+  struct timer *t;
+  uint64 next = -1, b;
+  int i, k;
+
+  acquire(&wheel.lock);
+  if(wheel.n[0] > 0){
+    // the first non-empty level-0 slot.
+    for(i = 0; i < NSLOT; i++){
+      t = wheel.slot[0][SLOT(0, wheel.now + i*WIDTH(0))];
+      if(t){
+        for(; t; t = t->next)
+          if(t->when < next)
+            next = t->when;
+        break;
+      }
+    }
+  }
+  // the next cascade of each level that has timers.
+  for(k = 1; k < NLEVEL; k++){
+    if(wheel.n[k] > 0){
+      b = (wheel.now | (WIDTH(k) - 1)) + 1;
+      if(b < next)
+        next = b;
+    }
+  }
+  release(&wheel.lock);
+  return next;
+}
+
+// Sleep until the time CSR reaches when.
+// Returns 0, or -1 if the process was killed first.
+int
+timersleep(uint64 when)
+{
+  struct proc *p = myproc();
+  struct timer t;
+
+  // already past: don't take the wheel lock, or sleep
+  // until the next tick to find out.
+  if(when <= r_time())
+    return 0;
+
+  acquire(&wheel.lock);
+  // place the timer relative to the present.
+  advance(r_time());
+  t.when = when;
+  t.fired = 0;
+  timeradd(&t);
+  while(!t.fired){
+    if(p->killed){
+      timerdel(&t);
+      release(&wheel.lock);
+      return -1;
+    }
+    sleep(&t, &wheel.lock);
+  }
+  release(&wheel.lock);
+  return 0;
+}
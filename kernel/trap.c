@@ -9,6 +9,10 @@
 struct spinlock tickslock;
 uint ticks;
 
+// harts ask for timer interrupts only while running a process
+// (to charge it ticks) and for the next timer in timer.c, so
+// ticks is brought up to date from the time CSR by tickupdate().
+
 extern char trampoline[], uservec[], userret[];
 
 // in kernelvec.S, calls kerneltrap().
@@ -16,6 +20,9 @@ void kernelvec();
 
 extern int devintr();
 
+// in uaccess.S, the kernel's copies to and from user memory.
+extern char uaccess_start[], uaccess_end[], uaccess_fault[];
+
 void
 trapinit(void)
 {
@@ -27,6 +34,9 @@ void
 trapinithart(void)
 {
   w_stvec((uint64)kernelvec);
+
+  // let user programs read the time and cycle CSRs.
+  w_scounteren(r_scounteren() | SCOUNTEREN_TM | SCOUNTEREN_CY);
 }
 
 //
@@ -67,6 +77,10 @@ usertrap(void)
     syscall();
   } else if((which_dev = devintr()) != 0){
     // ok
+  } else if((r_scause() == 12 || r_scause() == 13 || r_scause() == 15) &&
+            uvmfault(p, r_stval(), r_scause() == 12 ? PTE_X :
+                     r_scause() == 13 ? PTE_R : PTE_W, 1) == 0){
+    // copy-on-write, lazily allocated or mmap()ed page; now mapped.
   } else {
     printf("usertrap(): unexpected scause %p pid=%d\n", r_scause(), p->pid);
     printf("            sepc=%p stval=%p\n", r_sepc(), r_stval());
@@ -76,8 +90,9 @@ usertrap(void)
   if(p->killed)
     exit(-1);
 
-  // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2)
+  // give up the CPU if this is a timer interrupt
+  // and the scheduler says so.
+  if(which_dev == 2 && schedtick())
     yield();
 
   usertrapret();
@@ -101,7 +116,7 @@ usertrapret(void)
 
   // set up trapframe values that uservec will need when
   // the process next re-enters the kernel.
-  p->trapframe->kernel_satp = r_satp();         // kernel page table
+  p->trapframe->kernel_satp = MAKE_SATP(p->kpagetable); // kernel page table
   p->trapframe->kernel_sp = p->kstack + PGSIZE; // process's kernel stack
   p->trapframe->kernel_trap = (uint64)usertrap;
   p->trapframe->kernel_hartid = r_tp();         // hartid for cpuid()
@@ -125,7 +140,7 @@ usertrapret(void)
   // switches to the user page table, restores user registers,
   // and switches to user mode with sret.
   uint64 fn = TRAMPOLINE + (userret - trampoline);
-  ((void (*)(uint64,uint64))fn)(TRAPFRAME, satp);
+  ((void (*)(uint64,uint64))fn)(p->tfva, satp);
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
@@ -143,14 +158,35 @@ kerneltrap()
   if(intr_get() != 0)
     panic("kerneltrap: interrupts enabled");
 
-  if((which_dev = devintr()) == 0){
+  // a copy to or from user memory may have been interrupted;
+  // don't let whatever runs next (e.g. after a yield()) see
+  // user memory. the sstatus restored below sets SUM again.
+  w_sstatus(sstatus & ~SSTATUS_SUM);
+
+  if((scause == 13 || scause == 15) &&
+     sepc >= (uint64)uaccess_start && sepc < (uint64)uaccess_end){
+    // a page fault in copyin() &c on user memory that
+    // isn't mapped yet. map it, or make the copy fail.
+    // the fault may sleep (to read a file) only if the
+    // copy ran with interrupts on and no locks held.
+    uint64 va = r_stval();
+    int cansleep = (sstatus & SSTATUS_SPIE) && mycpu()->noff == 0;
+    if(cansleep)
+      intr_on();
+    if(uvmfault(myproc(), va, scause == 15 ? PTE_W : PTE_R, cansleep) < 0)
+      sepc = (uint64)uaccess_fault;
+    intr_off();
+    sfence_vma();
+  } else if((which_dev = devintr()) == 0){
     printf("scause %p\n", scause);
     printf("sepc=%p stval=%p\n", r_sepc(), r_stval());
     panic("kerneltrap");
   }
 
-  // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING)
+  // give up the CPU if this is a timer interrupt
+  // and the scheduler says so.
+  if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING &&
+     schedtick())
     yield();
 
   // the yield() may have caused some traps to occur,
@@ -159,13 +195,66 @@ kerneltrap()
   w_sstatus(sstatus);
 }
 
+// Bring ticks up to date, and boost priorities if
+// BOOSTTICKS have gone by.
+// Caller must hold tickslock.
+void
+tickupdate(void)
+{
+  uint now = r_time() / TICKCYCLES;
+
+  if(now == ticks)
+    return;
+  if(now / BOOSTTICKS != ticks / BOOSTTICKS)
+    priboost();
+  ticks = now;
+}
+
 void
 clockintr()
 {
   acquire(&tickslock);
-  ticks++;
-  wakeup(&ticks);
+  tickupdate();
   release(&tickslock);
+  timerexpire(r_time());
+}
+
+// Ask for this hart's next timer interrupt at time when,
+// or for none if when is -1.
+// Caller has interrupts off.
+static void
+settimer(uint64 when)
+{
+  struct cpu *c = mycpu();
+
+  if(c->timer != when){
+    c->timer = when;
+    sbi_set_timer(when);
+  }
+}
+
+// This hart is about to run a process: ask for a timer
+// interrupt at the next tick, to charge the process for its
+// time slice, or for the next timer if that is sooner.
+// Must not hold a process's lock (timernext() locks the wheel).
+void
+timerbusy(void)
+{
+  uint64 next = (r_time() / TICKCYCLES + 1) * TICKCYCLES;
+  uint64 t = timernext();
+
+  push_off();
+  settimer(t < next ? t : next);
+  pop_off();
+}
+
+// This hart is going idle: it needs a timer interrupt only
+// for the next timer.
+// Caller has interrupts off.
+void
+timeridle(void)
+{
+  settimer(timernext());
 }
 
 // check if it's an external interrupt or software interrupt,
@@ -201,17 +290,30 @@ devintr()
 
     return 1;
   } else if(scause == 0x8000000000000001L){
-    // software interrupt from a machine-mode timer interrupt,
-    // forwarded by timervec in kernelvec.S.
+    // software interrupt from a machine-mode timer interrupt
+    // or another hart's sbi_send_ipi(), forwarded by timervec
+    // in kernelvec.S.
+    struct cpu *c = mycpu();
 
-    if(cpuid() == 0){
-      clockintr();
-    }
-    
     // acknowledge the software interrupt by clearing
     // the SSIP bit in sip.
     w_sip(r_sip() & ~2);
 
+    // another hart may have changed the page table of
+    // the thread running here (see shootdown()).
+    tlbflush();
+
+    // only a wakeup for an idle hart (see kickidle()),
+    // or a TLB shootdown.
+    if(r_time() < c->timer)
+      return 1;
+
+    // timervec turned the timer off.
+    c->timer = -1;
+    clockintr();
+    if(c->proc)
+      timerbusy();
+
     return 2;
   } else {
     return 0;
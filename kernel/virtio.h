@@ -43,9 +43,10 @@
 #define VIRTIO_RING_F_INDIRECT_DESC 28
 #define VIRTIO_RING_F_EVENT_IDX     29
 
-// this many virtio descriptors.
-// must be a power of two.
-#define NUM 8
+// this many virtio descriptors, and so requests in flight.
+// must be a power of two, and small enough for the
+// descriptors and avail ring to fit in one page.
+#define NUM 64
 
 struct VRingDesc {
   uint64 addr;
@@ -55,6 +56,7 @@ struct VRingDesc {
 };
 #define VRING_DESC_F_NEXT  1 // chained with another descriptor
 #define VRING_DESC_F_WRITE 2 // device writes (vs read)
+#define VRING_DESC_F_INDIRECT 4 // addr is a table of descriptors
 
 struct VRingUsedElem {
   uint32 id;   // index of start of completed descriptor chain
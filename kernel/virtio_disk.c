@@ -22,29 +22,41 @@
 
 static struct disk {
  // memory for virtio descriptors &c for queue 0.
- // this is a global instead of allocated because it must
- // be multiple contiguous pages, which kalloc()
- // doesn't support, and page aligned.
-  char pages[2*PGSIZE];
+ // two physically contiguous pages from kalloc_pages(1).
+  char *pages;
   struct VRingDesc *desc;
   uint16 *avail;
   struct UsedArea *used;
 
   // our own book-keeping.
   char free[NUM];  // is a descriptor free?
-  uint16 used_idx; // we've looked this far in used[2..NUM].
+  uint16 used_idx; // we've looked this far in used->elems[].
+  int indirect;    // does the device take indirect descriptors?
 
   // track info about in-flight operations,
   // for use when completion interrupt arrives.
-  // indexed by first descriptor index of chain.
+  // indexed by the request's first descriptor in the ring.
+  // ind[] holds the request's three descriptors: the header,
+  // the data, and the status byte. with indirect descriptors
+  // the ring descriptor points at ind[]; without, ind[] is
+  // copied into a chain of three ring descriptors. all of
+  // them are here rather than on the stack of the process
+  // that started the request, which need not wait.
   struct {
+    struct VRingDesc ind[3];
     struct buf *b;
     char status;
+    struct virtio_blk_outhdr {
+      uint32 type;
+      uint32 reserved;
+      uint64 sector;
+    } hdr;
   } info[NUM];
   
-  struct spinlock vdisk_lock;
+  struct spinlock vdisk_lock;  // the rings, free[] and info[]
+  struct spinlock done_lock;   // b->disk going to 0, for virtio_disk_wait()
   
-} __attribute__ ((aligned (PGSIZE))) disk;
+} disk;
 
 void
 virtio_disk_init(void)
@@ -52,6 +64,7 @@ virtio_disk_init(void)
   uint32 status = 0;
 
   initlock(&disk.vdisk_lock, "virtio_disk");
+  initlock(&disk.done_lock, "virtio_done");
 
   if(*R(VIRTIO_MMIO_MAGIC_VALUE) != 0x74726976 ||
      *R(VIRTIO_MMIO_VERSION) != 1 ||
@@ -74,7 +87,9 @@ virtio_disk_init(void)
   features &= ~(1 << VIRTIO_BLK_F_MQ);
   features &= ~(1 << VIRTIO_F_ANY_LAYOUT);
   features &= ~(1 << VIRTIO_RING_F_EVENT_IDX);
-  features &= ~(1 << VIRTIO_RING_F_INDIRECT_DESC);
+  // qemu offers indirect descriptors; without them a request
+  // takes three ring descriptors instead of one.
+  disk.indirect = (features & (1 << VIRTIO_RING_F_INDIRECT_DESC)) != 0;
   *R(VIRTIO_MMIO_DRIVER_FEATURES) = features;
 
   // tell device that feature negotiation is complete.
@@ -95,7 +110,9 @@ virtio_disk_init(void)
   if(max < NUM)
     panic("virtio disk max queue too short");
   *R(VIRTIO_MMIO_QUEUE_NUM) = NUM;
-  memset(disk.pages, 0, sizeof(disk.pages));
+  if((disk.pages = kalloc_pages(1)) == 0)
+    panic("virtio disk kalloc");
+  memset(disk.pages, 0, 2*PGSIZE);
   *R(VIRTIO_MMIO_QUEUE_PFN) = ((uint64)disk.pages) >> PGSHIFT;
 
   // desc = pages -- num * VRingDesc
@@ -143,18 +160,25 @@ static void
 free_chain(int i)
 {
   while(1){
+    int flag = disk.desc[i].flags;
+    int nxt = disk.desc[i].next;
     free_desc(i);
-    if(disk.desc[i].flags & VRING_DESC_F_NEXT)
-      i = disk.desc[i].next;
+    if(flag & VRING_DESC_F_NEXT)
+      i = nxt;
     else
       break;
   }
 }
 
+// Allocate the ring descriptors for one request into idx[]:
+// just one if the device takes indirect descriptors, three
+// otherwise. Returns 0, or -1 if there aren't enough free.
 static int
-alloc3_desc(int *idx)
+alloc_req(int *idx)
 {
-  for(int i = 0; i < 3; i++){
+  int n = disk.indirect ? 1 : 3;
+
+  for(int i = 0; i < n; i++){
     idx[i] = alloc_desc();
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
@@ -165,106 +189,190 @@ alloc3_desc(int *idx)
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// Make the descriptors in idx[], from alloc_req(), a request
+// to read or write b.
+// Caller must hold vdisk_lock.
+static void
+fill_desc(int *idx, struct buf *b, int write)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
-
-  acquire(&disk.vdisk_lock);
+  int d = idx[0];
+  struct virtio_blk_outhdr *hdr = &disk.info[d].hdr;
+  struct VRingDesc *ind = disk.info[d].ind;
 
   // the spec says that legacy block operations use three
   // descriptors: one for type/reserved/sector, one for
-  // the data, one for a 1-byte status result.
-
-  // allocate the three descriptors.
-  int idx[3];
-  while(1){
-    if(alloc3_desc(idx) == 0) {
-      break;
-    }
-    sleep(&disk.free[0], &disk.vdisk_lock);
-  }
-  
-  // format the three descriptors.
-  // qemu's virtio-blk.c reads them.
-
-  struct virtio_blk_outhdr {
-    uint32 type;
-    uint32 reserved;
-    uint64 sector;
-  } buf0;
+  // the data, one for a 1-byte status result. they go in
+  // an indirect table, so a request takes one descriptor
+  // of the ring, if the device allows. qemu's virtio-blk.c
+  // reads them.
 
   if(write)
-    buf0.type = VIRTIO_BLK_T_OUT; // write the disk
+    hdr->type = VIRTIO_BLK_T_OUT; // write the disk
   else
-    buf0.type = VIRTIO_BLK_T_IN; // read the disk
-  buf0.reserved = 0;
-  buf0.sector = sector;
-
-  // buf0 is on a kernel stack, which is not direct mapped,
-  // thus the call to kvmpa().
-  disk.desc[idx[0]].addr = (uint64) kvmpa((uint64) &buf0);
-  disk.desc[idx[0]].len = sizeof(buf0);
-  disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
-  disk.desc[idx[0]].next = idx[1];
-
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
+    hdr->type = VIRTIO_BLK_T_IN; // read the disk
+  hdr->reserved = 0;
+  hdr->sector = b->blockno * (BSIZE / 512);
+
+  ind[0].addr = (uint64) hdr;
+  ind[0].len = sizeof(*hdr);
+  ind[0].flags = VRING_DESC_F_NEXT;
+  ind[0].next = 1;
+
+  ind[1].addr = (uint64) b->data;
+  ind[1].len = BSIZE;
   if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
+    ind[1].flags = 0; // device reads b->data
   else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
-
-  disk.info[idx[0]].status = 0;
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
+    ind[1].flags = VRING_DESC_F_WRITE; // device writes b->data
+  ind[1].flags |= VRING_DESC_F_NEXT;
+  ind[1].next = 2;
+
+  disk.info[d].status = 0xff;
+  ind[2].addr = (uint64) &disk.info[d].status;
+  ind[2].len = 1;
+  ind[2].flags = VRING_DESC_F_WRITE; // device writes the status
+  ind[2].next = 0;
+
+  if(disk.indirect){
+    disk.desc[d].addr = (uint64) ind;
+    disk.desc[d].len = sizeof(disk.info[d].ind);
+    disk.desc[d].flags = VRING_DESC_F_INDIRECT;
+    disk.desc[d].next = 0;
+  } else {
+    for(int i = 0; i < 3; i++){
+      disk.desc[idx[i]] = ind[i];
+      if(i < 2)
+        disk.desc[idx[i]].next = idx[i+1];
+    }
+  }
 
   // record struct buf for virtio_disk_intr().
   b->disk = 1;
-  disk.info[idx[0]].b = b;
+  disk.info[d].b = b;
+}
 
+// Make the last n requests put in the avail ring visible to
+// the device, and tell it to look.
+// Caller must hold vdisk_lock.
+static void
+notify(int n)
+{
   // avail[0] is flags
   // avail[1] tells the device how far to look in avail[2...].
   // avail[2...] are desc[] indices the device should process.
-  // we only tell device the first index in our chain of descriptors.
-  disk.avail[2 + (disk.avail[1] % NUM)] = idx[0];
   __sync_synchronize();
-  disk.avail[1] = disk.avail[1] + 1;
+  disk.avail[1] = disk.avail[1] + n;
+  __sync_synchronize();
 
   *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+}
 
-  // Wait for virtio_disk_intr() to say request has finished.
-  while(b->disk == 1) {
-    sleep(b, &disk.vdisk_lock);
+// Give the device requests to read or write the n bufs in
+// bs, notifying it once for all of them. If the ring fills
+// up, let the device start on what is queued so far, and
+// wait for descriptors to come free.
+static void
+virtio_disk_submit(struct buf **bs, int n, int write)
+{
+  int idx[3], queued = 0;
+
+  acquire(&disk.vdisk_lock);
+  for(int i = 0; i < n; i++){
+    while(alloc_req(idx) < 0){
+      if(queued > 0){
+        notify(queued);
+        queued = 0;
+      }
+      sleep(&disk.free[0], &disk.vdisk_lock);
+    }
+    fill_desc(idx, bs[i], write);
+    disk.avail[2 + ((disk.avail[1] + queued) % NUM)] = idx[0];
+    queued++;
   }
+  if(queued > 0)
+    notify(queued);
+  release(&disk.vdisk_lock);
+}
+
+// Read or write b, and wait for the disk to finish.
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  virtio_disk_submit(&b, 1, write);
+  virtio_disk_wait(b);
+}
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
+// Start reading or writing b, without waiting for the disk.
+// When it is done, virtio_disk_intr() calls b->iodone(b) if
+// it is set, and otherwise wakes up virtio_disk_wait(b).
+void
+virtio_disk_start(struct buf *b, int write)
+{
+  virtio_disk_submit(&b, 1, write);
+}
 
-  release(&disk.vdisk_lock);
+// virtio_disk_start() each of the n bufs in bs, with a
+// single notification of the device.
+void
+virtio_disk_startv(struct buf **bs, int n, int write)
+{
+  virtio_disk_submit(bs, n, write);
 }
 
+// Wait for the disk to finish a request for b
+// that virtio_disk_start() began.
+void
+virtio_disk_wait(struct buf *b)
+{
+  acquire(&disk.done_lock);
+  while(b->disk == 1) {
+    sleep(b, &disk.done_lock);
+  }
+  release(&disk.done_lock);
+}
+
+// Take every finished request off the used ring, and then,
+// without vdisk_lock, let the waiters for their bufs know.
 void
 virtio_disk_intr()
 {
+  struct buf *done[NUM], *b;
+  int n = 0;
+
   acquire(&disk.vdisk_lock);
 
-  while((disk.used_idx % NUM) != (disk.used->id % NUM)){
-    int id = disk.used->elems[disk.used_idx].id;
+  // acknowledge first, so that a request that finishes
+  // after the loop below looks raises a new interrupt.
+  *R(VIRTIO_MMIO_INTERRUPT_ACK) = *R(VIRTIO_MMIO_INTERRUPT_STATUS) & 0x3;
+  __sync_synchronize();
+
+  while(disk.used_idx != disk.used->id){
+    __sync_synchronize();
+    int id = disk.used->elems[disk.used_idx % NUM].id;
 
     if(disk.info[id].status != 0)
       panic("virtio_disk_intr status");
-    
-    disk.info[id].b->disk = 0;   // disk is done with buf
-    wakeup(disk.info[id].b);
 
-    disk.used_idx = (disk.used_idx + 1) % NUM;
+    done[n++] = disk.info[id].b;
+    disk.info[id].b = 0;
+    free_chain(id);
+    disk.used_idx++;
   }
-  *R(VIRTIO_MMIO_INTERRUPT_ACK) = *R(VIRTIO_MMIO_INTERRUPT_STATUS) & 0x3;
 
   release(&disk.vdisk_lock);
+
+  for(int i = 0; i < n; i++){
+    b = done[i];
+    if(b->iodone){
+      void (*iodone)(struct buf*) = b->iodone;
+      b->iodone = 0;
+      b->disk = 0;   // disk is done with buf
+      iodone(b);
+    } else {
+      acquire(&disk.done_lock);
+      b->disk = 0;   // disk is done with buf
+      wakeup(b);
+      release(&disk.done_lock);
+    }
+  }
 }
@@ -3,9 +3,15 @@
 #include "memlayout.h"
 #include "elf.h"
 #include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
 #include "defs.h"
 #include "fs.h"
 
+// how many pages a fault on the lazily allocated
+// heap maps at once, starting at the faulting page.
+#define FAULTAROUND 8
+
 /*
  * the kernel's page table.
  */
@@ -15,14 +21,19 @@ extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
 
+// uaccess.S
+extern int copy_user(void *dst, void *src, uint64 n);
+extern int copystr_user(char *dst, char *src, uint64 max);
+
+static pte_t *walkmega(pagetable_t, uint64, int);
+
 /*
  * create a direct-map page table for the kernel.
  */
 void
 kvminit()
 {
-  kernel_pagetable = (pagetable_t) kalloc();
-  memset(kernel_pagetable, 0, PGSIZE);
+  kernel_pagetable = (pagetable_t) kzalloc();
 
   // uart registers
   kvmmap(UART0, UART0, PGSIZE, PTE_R | PTE_W);
@@ -40,6 +51,8 @@ kvminit()
   kvmmap(KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X);
 
   // map kernel data and the physical RAM we'll make use of.
+  // mappages() uses megapages from the first 2-megabyte
+  // boundary on, so most of RAM takes one PTE per megapage.
   kvmmap((uint64)etext, (uint64)etext, PHYSTOP-(uint64)etext, PTE_R | PTE_W);
 
   // map the trampoline for trap entry/exit to
@@ -56,6 +69,59 @@ kvminithart()
   sfence_vma();
 }
 
+// Create a kernel page table for a process whose user page
+// table is upt. It shares all of kernel_pagetable's page-table
+// pages except the one for the first gigabyte of addresses,
+// where it uses upt's instead, so that the kernel sees user
+// memory at user addresses (see copyin()). The kernel's
+// devices in that gigabyte are added to upt by uvmdevmap().
+// Returns 0 if out of memory.
+pagetable_t
+kvmcreate(pagetable_t upt)
+{
+  pagetable_t kpt;
+
+  if((kpt = (pagetable_t)kzalloc()) == 0)
+    return 0;
+  for(int i = 1; i < 512; i++)
+    kpt[i] = kernel_pagetable[i];
+  kpt[0] = upt[0];
+  return kpt;
+}
+
+// Give user page table upt the kernel's mappings of the
+// devices at PLIC and above, without PTE_U, so that
+// a kernel page table made by kvmcreate() still reaches
+// them. User memory must lie below PLIC.
+// Returns 0 on success, -1 if out of memory.
+int
+uvmdevmap(pagetable_t upt)
+{
+  pagetable_t ul1, kl1;
+
+  if(walkmega(upt, 0, 1) == 0)
+    return -1;
+  ul1 = (pagetable_t)PTE2PA(upt[0]);
+  kl1 = (pagetable_t)PTE2PA(kernel_pagetable[0]);
+  for(int i = PX(1, PLIC); i < 512; i++)
+    ul1[i] = kl1[i];
+  return 0;
+}
+
+// Remove the mappings added by uvmdevmap(), which refer to
+// the kernel's page-table pages, before upt is freed.
+void
+uvmdevunmap(pagetable_t upt)
+{
+  pagetable_t ul1;
+
+  if((upt[0] & PTE_V) == 0)
+    return;
+  ul1 = (pagetable_t)PTE2PA(upt[0]);
+  for(int i = PX(1, PLIC); i < 512; i++)
+    ul1[i] = 0;
+}
+
 // Return the address of the PTE in page table pagetable
 // that corresponds to virtual address va.  If alloc!=0,
 // create any required page-table pages.
@@ -68,6 +134,9 @@ kvminithart()
 //   21..29 -- 9 bits of level-1 index.
 //   12..20 -- 9 bits of level-0 index.
 //    0..11 -- 12 bits of byte offset within the page.
+//
+// If va lies in a megapage, returns the level-1 PTE that
+// maps the whole megapage; it has PTE_MEGA set.
 pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
 {
@@ -76,18 +145,76 @@ walk(pagetable_t pagetable, uint64 va, int alloc)
 
   for(int level = 2; level > 0; level--) {
     pte_t *pte = &pagetable[PX(level, va)];
-    if(*pte & PTE_V) {
+    if(*pte & PTE_MEGA) {
+      return pte;
+    } else if(*pte & PTE_V) {
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
+      if(!alloc || (pagetable = (pde_t*)kzalloc()) == 0)
         return 0;
-      memset(pagetable, 0, PGSIZE);
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
   return &pagetable[PX(0, va)];
 }
 
+// Return the address of the level-1 PTE for va, which maps
+// either a megapage or a page-table page.  If alloc!=0,
+// create the level-1 page-table page if required.
+static pte_t *
+walkmega(pagetable_t pagetable, uint64 va, int alloc)
+{
+  pte_t *pte;
+
+  if(va >= MAXVA)
+    panic("walkmega");
+
+  pte = &pagetable[PX(2, va)];
+  if(*pte & PTE_V) {
+    pagetable = (pagetable_t)PTE2PA(*pte);
+  } else {
+    if(!alloc || (pagetable = (pde_t*)kzalloc()) == 0)
+      return 0;
+    *pte = PA2PTE(pagetable) | PTE_V;
+  }
+  return &pagetable[PX(1, va)];
+}
+
+// Physical address of the 4096-byte page at va,
+// given the leaf PTE that walk() returned for va.
+static uint64
+pteaddr(pte_t pte, uint64 va)
+{
+  if(pte & PTE_MEGA)
+    return PTE2PA(pte) + (PGROUNDDOWN(va) & (MPGSIZE-1));
+  return PTE2PA(pte);
+}
+
+// Replace the megapage mapping of va, if there is one, with
+// a page-table page of 512 PTEs that map the same pages with
+// the same permissions.
+// Returns 0 on success, -1 if out of memory.
+static int
+uvmsplit(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  pagetable_t l0;
+  uint64 pa;
+  uint flags;
+
+  pte = walkmega(pagetable, va, 0);
+  if(pte == 0 || (*pte & PTE_MEGA) == 0)
+    return 0;
+  if((l0 = (pagetable_t)kalloc()) == 0)
+    return -1;
+  pa = PTE2PA(*pte);
+  flags = PTE_FLAGS(*pte) & ~PTE_MEGA;
+  for(int i = 0; i < 512; i++)
+    l0[i] = PA2PTE(pa + i*PGSIZE) | flags;
+  *pte = PA2PTE(l0) | PTE_V;
+  return 0;
+}
+
 // Look up a virtual address, return the physical address,
 // or 0 if not mapped.
 // Can only be used to look up user pages.
@@ -107,7 +234,7 @@ walkaddr(pagetable_t pagetable, uint64 va)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
-  pa = PTE2PA(*pte);
+  pa = pteaddr(*pte, va);
   return pa;
 }
 
@@ -137,14 +264,16 @@ kvmpa(uint64 va)
     panic("kvmpa");
   if((*pte & PTE_V) == 0)
     panic("kvmpa");
-  pa = PTE2PA(*pte);
+  pa = pteaddr(*pte, va);
   return pa+off;
 }
 
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa. va and size might not
-// be page-aligned. Returns 0 on success, -1 if walk() couldn't
-// allocate a needed page-table page.
+// be page-aligned. Wherever va and pa are both at a megapage
+// boundary and a whole megapage remains to be mapped, uses
+// a single megapage PTE for it. Returns 0 on success, -1 if
+// walk() couldn't allocate a needed page-table page.
 int
 mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 {
@@ -154,6 +283,18 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   a = PGROUNDDOWN(va);
   last = PGROUNDDOWN(va + size - 1);
   for(;;){
+    if(a % MPGSIZE == 0 && pa % MPGSIZE == 0 && last - a >= MPGSIZE - PGSIZE){
+      if((pte = walkmega(pagetable, a, 1)) == 0)
+        return -1;
+      if(*pte & PTE_V)
+        panic("remap");
+      *pte = PA2PTE(pa) | perm | PTE_MEGA | PTE_V;
+      if(last - a == MPGSIZE - PGSIZE)
+        break;
+      a += MPGSIZE;
+      pa += MPGSIZE;
+      continue;
+    }
     if((pte = walk(pagetable, a, 1)) == 0)
       return -1;
     if(*pte & PTE_V)
@@ -168,7 +309,10 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 }
 
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
+// page-aligned. Pages of a lazily allocated heap that were
+// never touched have no mapping, and are skipped; pages that
+// uvmrevoke() invalidated are still removed. Megapages
+// must lie entirely inside the range (see uvmsplit()).
 // Optionally free the physical memory.
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
@@ -180,18 +324,28 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
     panic("uvmunmap: not aligned");
 
   for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
-    if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
-    if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
-    if(PTE_FLAGS(*pte) == PTE_V)
+    if((pte = walk(pagetable, a, 0)) == 0 || *pte == 0)
+      continue;
+    if((*pte & (PTE_R|PTE_W|PTE_X)) == 0)
       panic("uvmunmap: not a leaf");
+    if(*pte & PTE_MEGA){
+      if(a % MPGSIZE != 0 || a + MPGSIZE > va + npages*PGSIZE)
+        panic("uvmunmap: part of a megapage");
+      if(do_free)
+        kfree_pages((void*)PTE2PA(*pte), 9);
+      *pte = 0;
+      a += MPGSIZE - PGSIZE;
+      continue;
+    }
     if(do_free){
       uint64 pa = PTE2PA(*pte);
       kfree((void*)pa);
     }
     *pte = 0;
   }
+  // the kernel may have cached these mappings
+  // while copying to or from user memory.
+  sfence_vma();
 }
 
 // create an empty user page table.
@@ -200,10 +354,9 @@ pagetable_t
 uvmcreate()
 {
   pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc();
+  pagetable = (pagetable_t) kzalloc();
   if(pagetable == 0)
     return 0;
-  memset(pagetable, 0, PGSIZE);
   return pagetable;
 }
 
@@ -217,8 +370,7 @@ uvminit(pagetable_t pagetable, uchar *src, uint sz)
 
   if(sz >= PGSIZE)
     panic("inituvm: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kzalloc();
   mappages(pagetable, 0, PGSIZE, (uint64)mem, PTE_W|PTE_R|PTE_X|PTE_U);
   memmove(mem, src, sz);
 }
@@ -236,12 +388,11 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 
   oldsz = PGROUNDUP(oldsz);
   for(a = oldsz; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kzalloc();
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0){
       kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
@@ -251,6 +402,162 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
   return newsz;
 }
 
+// Map zero-filled pages for a fault at va in a process whose
+// memory, up to sz, is allocated lazily (see growproc()).
+// If the whole megapage around va lies below sz, nothing in
+// it is mapped yet, and the buddy allocator has a megapage
+// free, maps a zeroed megapage. Otherwise maps the page
+// containing va and up to FAULTAROUND-1 of the unmapped
+// pages that follow it, stopping short of sz.
+// Returns 0 on success, or -1 if va is not a lazily allocated
+// address or memory is exhausted.
+int
+uvmlazy(pagetable_t pagetable, uint64 va, uint64 sz)
+{
+  uint64 a, last;
+  pte_t *pte;
+  char *mem;
+
+  if(va >= sz)
+    return -1;
+
+  a = MPGROUNDDOWN(va);
+  if(a + MPGSIZE <= PGROUNDUP(sz) &&
+     (pte = walkmega(pagetable, a, 1)) != 0 && (*pte & PTE_V) == 0 &&
+     (mem = ktry_pages(9)) != 0){
+    memset(mem, 0, MPGSIZE);
+    *pte = PA2PTE(mem) | PTE_W|PTE_X|PTE_R|PTE_U|PTE_MEGA|PTE_V;
+    return 0;
+  }
+
+  va = PGROUNDDOWN(va);
+  last = va + FAULTAROUND*PGSIZE;
+  if(last > PGROUNDUP(sz))
+    last = PGROUNDUP(sz);
+
+  for(a = va; a < last; a += PGSIZE){
+    if((pte = walk(pagetable, a, 1)) == 0 || (*pte & PTE_V))
+      break;  // out of memory, or already mapped (e.g. the stack guard).
+    if((mem = kzalloc()) == 0)
+      break;
+    *pte = PA2PTE(mem) | PTE_W|PTE_X|PTE_R|PTE_U|PTE_V;
+  }
+  return a == va ? -1 : 0;
+}
+
+// Resolve a write to a copy-on-write page at va by giving
+// the page table a private, writable copy of the page, or
+// by simply making the page writable if no one else still
+// shares it.
+// Returns 0 on success, or -1 if va is not a copy-on-write
+// page or memory is exhausted.
+int
+uvmcow(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  uint64 pa;
+  uint flags;
+  char *mem;
+
+  if(va >= MAXVA)
+    return -1;
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & (PTE_V|PTE_U|PTE_COW)) != (PTE_V|PTE_U|PTE_COW))
+    return -1;
+  if(*pte & PTE_MEGA){
+    // copy just the page being written.
+    if(uvmsplit(pagetable, va) < 0)
+      return -1;
+    pte = walk(pagetable, va, 0);
+  }
+  pa = PTE2PA(*pte);
+  flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+
+  if(krefs((void*)pa) == 1){
+    // the other sharers have already taken copies.
+    *pte = PA2PTE(pa) | flags;
+    return 0;
+  }
+  if((mem = kalloc()) == 0)
+    return -1;
+  memmove(mem, (void*)pa, PGSIZE);
+  *pte = PA2PTE(mem) | flags;
+  sfence_vma();
+  kfree((void*)pa);
+  return 0;
+}
+
+// Handle a page fault by p, from user code or from copyin()
+// and friends, at user address va, which needs access
+// (PTE_R, PTE_W or PTE_X): a store to a copy-on-write page,
+// or a touch of lazily allocated memory or of a mapped file.
+// cansleep is 0 if the faulting code holds a spin lock.
+// Returns 0 if the access can be retried, or -1.
+int
+uvmfault(struct proc *p, uint64 va, int access, int cansleep)
+{
+  struct mm *mm = p->mm;
+  pte_t *pte;
+  int r;
+
+  if(va >= MMAPTOP)
+    return -1;
+
+  acquire(&mm->lock);
+  pte = walk(mm->pagetable, va, 0);
+  if(pte && (*pte & (PTE_V|PTE_U)) == (PTE_V|PTE_U) && (*pte & access)){
+    // another thread got here first, and this hart's TLB
+    // may still hold the old entry; or the hardware leaves
+    // maintaining PTE_A and PTE_D to software.
+    *pte |= PTE_A | (access == PTE_W ? PTE_D : 0);
+    release(&mm->lock);
+    sfence_vma();
+    return 0;
+  }
+  if(access == PTE_W && uvmcow(mm->pagetable, va) == 0){
+    release(&mm->lock);
+    // other threads may still see the shared page.
+    if(mm->nthread > 1)
+      shootdown(mm, cansleep);
+    return 0;
+  }
+  if(va < mm->sz){
+    r = uvmlazy(mm->pagetable, va, mm->sz);
+    release(&mm->lock);
+    return r;
+  }
+  release(&mm->lock);
+  return mmapfault(p, va, access, cansleep);
+}
+
+// Invalidate the PTEs of the pages mapped in [va, end), so
+// that neither user code nor the kernel can reach the pages,
+// but keep the physical addresses for uvmunmap() to free them
+// with. A megapage that straddles va is split first; that is
+// the only thing that can fail, and it fails before any PTE
+// has changed. Used before freeing pages that other threads
+// may still reach through their TLBs (see shootdown()).
+// va and end must be page-aligned.
+// Returns 0, or -1 if out of memory.
+int
+uvmrevoke(pagetable_t pagetable, uint64 va, uint64 end)
+{
+  uint64 a;
+  pte_t *pte;
+
+  if(va < end && va % MPGSIZE != 0 && uvmsplit(pagetable, va) < 0)
+    return -1;
+  for(a = va; a < end; a += PGSIZE){
+    if((pte = walk(pagetable, a, 0)) == 0 || (*pte & PTE_V) == 0)
+      continue;
+    *pte &= ~PTE_V;
+    if(*pte & PTE_MEGA)
+      a += MPGSIZE - PGSIZE;
+  }
+  sfence_vma();
+  return 0;
+}
+
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
@@ -262,6 +569,11 @@ uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
     return oldsz;
 
   if(PGROUNDUP(newsz) < PGROUNDUP(oldsz)){
+    // a megapage that would be left partly mapped
+    // has to be broken up first.
+    if(PGROUNDUP(newsz) % MPGSIZE != 0 &&
+       uvmsplit(pagetable, PGROUNDUP(newsz)) < 0)
+      return oldsz;
     int npages = (PGROUNDUP(oldsz) - PGROUNDUP(newsz)) / PGSIZE;
     uvmunmap(pagetable, PGROUNDUP(newsz), npages, 1);
   }
@@ -301,37 +613,61 @@ uvmfree(pagetable_t pagetable, uint64 sz)
 
 // Given a parent process's page table, copy
 // its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// Shares the physical memory copy-on-write:
+// see uvmshare().
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
 uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
+{
+  return uvmshare(old, new, 0, sz, 1);
+}
+
+// Map the pages that old maps in [va, va+len) into new too.
+// With cow set, writable pages become read-only with PTE_COW
+// set in both page tables, and uvmcow() copies a page when
+// either process first writes it. Otherwise both map the
+// pages as they are, and new's mappings start out clean.
+// returns 0 on success, -1 on failure.
+// undoes new's mappings on failure.
+int
+uvmshare(pagetable_t old, pagetable_t new, uint64 va, uint64 len, int cow)
 {
   pte_t *pte;
   uint64 pa, i;
   uint flags;
-  char *mem;
 
-  for(i = 0; i < sz; i += PGSIZE){
+  for(i = va; i < va + len; i += PGSIZE){
     if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
+      continue;  // never touched; lazily allocated
     if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
+      continue;
+    if(cow && (*pte & PTE_W))
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     pa = PTE2PA(*pte);
-    flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-      kfree(mem);
-      goto err;
+    flags = PTE_FLAGS(*pte) & ~PTE_MEGA;
+    if(!cow)
+      flags &= ~PTE_D;
+    if(*pte & PTE_MEGA){
+      // share the whole megapage; mappages() maps it
+      // with a megapage PTE too.
+      if(mappages(new, i, MPGSIZE, pa, flags) != 0)
+        goto err;
+      for(int j = 0; j < 512; j++)
+        kdup((void*)(pa + j*PGSIZE));
+      i += MPGSIZE - PGSIZE;
+      continue;
     }
+    if(mappages(new, i, PGSIZE, pa, flags) != 0)
+      goto err;
+    kdup((void*)pa);
   }
+  if(cow)
+    sfence_vma();  // old's pages just lost PTE_W.
   return 0;
 
  err:
-  uvmunmap(new, 0, i / PGSIZE, 1);
+  uvmunmap(new, va, (i - va) / PGSIZE, 1);
   return -1;
 }
 
@@ -348,14 +684,40 @@ uvmclear(pagetable_t pagetable, uint64 va)
   *pte &= ~PTE_U;
 }
 
+// Is [va, va+len) a range of user addresses that the
+// current process's kernel page table maps (when it maps
+// them at all) to pagetable's memory, with user access?
+// The stack guard page is the one user page without PTE_U,
+// which the kernel reaches without a fault; a range that
+// touches it takes the page-table walk, which refuses it.
+static int
+uaccessok(pagetable_t pagetable, uint64 va, uint64 len)
+{
+  struct proc *p = myproc();
+  uint64 guard;
+
+  if(p == 0 || pagetable != p->pagetable ||
+     va >= MMAPTOP || len > MMAPTOP - va)
+    return 0;
+  guard = p->mm->guard;
+  return va + len <= guard || va >= guard + PGSIZE;
+}
+
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
 // Return 0 on success, -1 on error.
+// For the current process this is a plain copy through
+// its kernel page table; a fault on the way is resolved
+// (or turned into an error) by kerneltrap().
 int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
 
+  if(uaccessok(pagetable, dstva, len))
+    return copy_user((void*)dstva, src, len);
+
+  // a page table that isn't loaded, e.g. exec()'s new one.
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
     pa0 = walkaddr(pagetable, va0);
@@ -381,6 +743,9 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
   uint64 n, va0, pa0;
 
+  if(uaccessok(pagetable, srcva, len))
+    return copy_user(dst, (void*)srcva, len);
+
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
     pa0 = walkaddr(pagetable, va0);
@@ -408,6 +773,11 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
   uint64 n, va0, pa0;
   int got_null = 0;
 
+  if(srcva < MMAPTOP && max > MMAPTOP - srcva)
+    max = MMAPTOP - srcva;
+  if(uaccessok(pagetable, srcva, max))
+    return copystr_user(dst, (char*)srcva, max);
+
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
     pa0 = walkaddr(pagetable, va0);
@@ -0,0 +1,21 @@
+// Print the buffer cache's statistics.
+
+#include "kernel/types.h"
+#include "kernel/bcachestat.h"
+#include "user/user.h"
+
+int
+main(int argc, char *argv[])
+{
+  struct bcachestat st;
+
+  if(bcachestat(&st) < 0){
+    fprintf(2, "bcstat: bcachestat failed\n");
+    exit(1);
+  }
+  printf("bcache: %d buffers, %l hits, %l misses, %l evictions\n",
+         st.nbuf, st.hits, st.misses, st.evictions);
+  printf("bcache: %l blocks read ahead\n", st.readaheads);
+  printf("bcache: %l pages added, %l given back\n", st.grows, st.shrinks);
+  exit(0);
+}
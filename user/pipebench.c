@@ -0,0 +1,71 @@
+// Pipe ping-pong: a parent and a child bounce one byte
+// back and forth over two pipes, so every round trip costs
+// two sleeps and two wakeups. Extra processes asleep on
+// another pipe show that wakeup() doesn't slow down as the
+// process table fills.
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define N     10000             // round trips
+#define IDLE  20                // extra sleeping processes
+
+int
+main(int argc, char *argv[])
+{
+  int ping[2], pong[2], idle[2];
+  int i, pid, t0, t1;
+  char c = 0;
+
+  if(pipe(ping) < 0 || pipe(pong) < 0 || pipe(idle) < 0){
+    fprintf(2, "pipebench: pipe failed\n");
+    exit(1);
+  }
+
+  // idle processes: block reading a pipe nobody writes.
+  for(i = 0; i < IDLE; i++){
+    pid = fork();
+    if(pid < 0){
+      fprintf(2, "pipebench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      close(idle[1]);
+      read(idle[0], &c, 1);
+      exit(0);
+    }
+  }
+  close(idle[0]);
+
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "pipebench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    for(i = 0; i < N; i++){
+      if(read(ping[0], &c, 1) != 1)
+        break;
+      write(pong[1], &c, 1);
+    }
+    exit(0);
+  }
+
+  t0 = uptime();
+  for(i = 0; i < N; i++){
+    if(write(ping[1], &c, 1) != 1 || read(pong[0], &c, 1) != 1){
+      fprintf(2, "pipebench: ping-pong failed\n");
+      exit(1);
+    }
+  }
+  t1 = uptime();
+  wait(0);
+
+  // let the idle processes go.
+  close(idle[1]);
+  for(i = 0; i < IDLE; i++)
+    wait(0);
+
+  printf("pipebench: %d round trips in %d ticks\n", N, t1 - t0);
+  exit(0);
+}
@@ -0,0 +1,95 @@
+// Parallel sum: threads made with clone() share one array,
+// and each sums a slice of it, so one process keeps every
+// hart busy on a single data set. Compares one thread with
+// NCPU of them.
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "user/user.h"
+
+#define N      (1 << 21)        // array elements
+#define REPS   10               // passes over the array
+#define STACK  4096
+
+static uint *a;
+static int nthread;
+
+// one per thread, a cache line apart.
+static struct {
+  uint64 sum;
+  char pad[56];
+} partial[NCPU];
+
+static void
+worker(void *arg)
+{
+  int id = (int)(uint64)arg;
+  int lo = N / nthread * id;
+  int hi = id == nthread-1 ? N : lo + N / nthread;
+  uint64 sum = 0;
+
+  for(int r = 0; r < REPS; r++)
+    for(int i = lo; i < hi; i++)
+      sum += a[i];
+  partial[id].sum = sum;
+  exit(0);
+}
+
+// Sum the array with n threads; return the sum, and the
+// ticks it took in *ticks.
+static uint64
+psum(int n, char *stacks[], int *ticks)
+{
+  int i, t0, tid[NCPU], xstatus;
+  uint64 sum = 0;
+
+  nthread = n;
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    tid[i] = clone(worker, (void*)(uint64)i, stacks[i] + STACK);
+    if(tid[i] < 0){
+      fprintf(2, "psum: clone failed\n");
+      exit(1);
+    }
+  }
+  for(i = 0; i < n; i++){
+    if(join(tid[i], &xstatus) != tid[i] || xstatus != 0){
+      fprintf(2, "psum: join failed\n");
+      exit(1);
+    }
+    sum += partial[i].sum;
+  }
+  *ticks = uptime() - t0;
+  return sum;
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *stacks[NCPU];
+  uint64 s1, sn;
+  int i, t1, tn;
+
+  if((a = (uint*)sbrk(N * sizeof(uint))) == (uint*)-1){
+    fprintf(2, "psum: sbrk failed\n");
+    exit(1);
+  }
+  for(i = 0; i < N; i++)
+    a[i] = i;
+  for(i = 0; i < NCPU; i++){
+    if((stacks[i] = malloc(STACK)) == 0){
+      fprintf(2, "psum: malloc failed\n");
+      exit(1);
+    }
+  }
+
+  s1 = psum(1, stacks, &t1);
+  sn = psum(NCPU, stacks, &tn);
+  if(s1 != sn || s1 != (uint64)REPS * N / 2 * (N - 1)){
+    fprintf(2, "psum: wrong sum\n");
+    exit(1);
+  }
+  printf("psum: %d elements x %d: 1 thread %d ticks, %d threads %d ticks\n",
+         N, REPS, t1, NCPU, tn);
+  exit(0);
+}
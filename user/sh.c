@@ -3,6 +3,7 @@
 #include "kernel/types.h"
 #include "user/user.h"
 #include "kernel/fcntl.h"
+#include "kernel/spawn.h"
 
 // Parsed command representation
 #define EXEC  1
@@ -53,6 +54,18 @@ int fork1(void);  // Fork but panics on failure.
 void panic(char*);
 struct cmd *parsecmd(char*);
 
+// Start the plain command ecmd in a new process made by
+// spawn(), which loads the program without first copying
+// the shell. act lists file descriptor changes for the child.
+void
+spawncmd(struct execcmd *ecmd, struct spawnact *act, int nact)
+{
+  if(ecmd->argv[0] == 0)
+    return;
+  if(spawn(ecmd->argv[0], ecmd->argv, act, nact) < 0)
+    fprintf(2, "exec %s failed\n", ecmd->argv[0]);
+}
+
 // Execute cmd.  Never returns.
 void
 runcmd(struct cmd *cmd)
@@ -63,6 +76,7 @@ runcmd(struct cmd *cmd)
   struct listcmd *lcmd;
   struct pipecmd *pcmd;
   struct redircmd *rcmd;
+  struct spawnact act[3];
 
   if(cmd == 0)
     exit(1);
@@ -91,7 +105,9 @@ runcmd(struct cmd *cmd)
 
   case LIST:
     lcmd = (struct listcmd*)cmd;
-    if(fork1() == 0)
+    if(lcmd->left->type == EXEC)
+      spawncmd((struct execcmd*)lcmd->left, 0, 0);
+    else if(fork1() == 0)
       runcmd(lcmd->left);
     wait(0);
     runcmd(lcmd->right);
@@ -101,14 +117,22 @@ runcmd(struct cmd *cmd)
     pcmd = (struct pipecmd*)cmd;
     if(pipe(p) < 0)
       panic("pipe");
-    if(fork1() == 0){
+    act[1] = (struct spawnact){ SPAWN_CLOSE, p[0], 0 };
+    act[2] = (struct spawnact){ SPAWN_CLOSE, p[1], 0 };
+    if(pcmd->left->type == EXEC){
+      act[0] = (struct spawnact){ SPAWN_DUP2, p[1], 1 };
+      spawncmd((struct execcmd*)pcmd->left, act, 3);
+    } else if(fork1() == 0){
       close(1);
       dup(p[1]);
       close(p[0]);
       close(p[1]);
       runcmd(pcmd->left);
     }
-    if(fork1() == 0){
+    if(pcmd->right->type == EXEC){
+      act[0] = (struct spawnact){ SPAWN_DUP2, p[0], 0 };
+      spawncmd((struct execcmd*)pcmd->right, act, 3);
+    } else if(fork1() == 0){
       close(0);
       dup(p[0]);
       close(p[0]);
@@ -123,7 +147,9 @@ runcmd(struct cmd *cmd)
 
   case BACK:
     bcmd = (struct backcmd*)cmd;
-    if(fork1() == 0)
+    if(bcmd->cmd->type == EXEC)
+      spawncmd((struct execcmd*)bcmd->cmd, 0, 0);
+    else if(fork1() == 0)
       runcmd(bcmd->cmd);
     break;
   }
@@ -0,0 +1,58 @@
+// Compare the cost of starting a program with fork()
+// followed by exec() against spawn(). The parent first
+// grows and touches a heap, since fork() has to share
+// every one of those pages with the child (only for exec()
+// to throw them away), while spawn() never looks at them.
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define N    200                // processes started each way
+#define HEAP (4*1024*1024)      // bytes of parent memory
+
+int
+main(int argc, char *argv[])
+{
+  char *args[] = { "spawnbench", "child", 0 };
+  char *heap;
+  int i, pid, t0, t1, t2;
+
+  if(argc > 1 && strcmp(argv[1], "child") == 0)
+    exit(0);
+
+  heap = sbrk(HEAP);
+  if(heap == (char*)-1){
+    fprintf(2, "spawnbench: sbrk failed\n");
+    exit(1);
+  }
+  for(i = 0; i < HEAP; i += 4096)
+    heap[i] = 1;
+
+  t0 = uptime();
+  for(i = 0; i < N; i++){
+    pid = fork();
+    if(pid < 0){
+      fprintf(2, "spawnbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      exec(args[0], args);
+      fprintf(2, "spawnbench: exec failed\n");
+      exit(1);
+    }
+    wait(0);
+  }
+  t1 = uptime();
+  for(i = 0; i < N; i++){
+    if(spawn(args[0], args, 0, 0) < 0){
+      fprintf(2, "spawnbench: spawn failed\n");
+      exit(1);
+    }
+    wait(0);
+  }
+  t2 = uptime();
+
+  printf("fork+exec: %d ticks for %d processes\n", t1 - t0, N);
+  printf("spawn:     %d ticks for %d processes\n", t2 - t1, N);
+  exit(0);
+}
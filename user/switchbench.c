@@ -0,0 +1,66 @@
+// Context switch latency: a parent and a child, both pinned
+// to hart 0, take turns calling sched_yield(), so that each
+// call switches from one to the other. Times are in cycles
+// (the cycle CSR), averaged over N calls. The cost of a null
+// system call is measured first and subtracted, to leave the
+// cost of the switch itself.
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define N 20000
+
+static uint64
+rdcycle(void)
+{
+  uint64 c;
+  asm volatile("rdcycle %0" : "=r" (c));
+  return c;
+}
+
+int
+main(int argc, char *argv[])
+{
+  uint64 t0, sys, yld;
+  int i, pid;
+
+  t0 = rdcycle();
+  for(i = 0; i < N; i++)
+    getpid();
+  sys = (rdcycle() - t0) / N;
+
+  if(sched_setaffinity(0, 1) < 0){
+    fprintf(2, "switchbench: sched_setaffinity failed\n");
+    exit(1);
+  }
+
+  // alone on the hart, sched_yield() has nothing to switch to.
+  t0 = rdcycle();
+  for(i = 0; i < N; i++)
+    sched_yield();
+  yld = (rdcycle() - t0) / N;
+  printf("switchbench: null syscall %d cycles, lone yield %d cycles\n",
+         (int)sys, (int)yld);
+
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "switchbench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    for(;;)
+      sched_yield();
+  }
+
+  // each iteration switches to the child and back.
+  sched_yield();
+  t0 = rdcycle();
+  for(i = 0; i < N; i++)
+    sched_yield();
+  yld = (rdcycle() - t0) / N;
+  kill(pid);
+  wait(0);
+
+  printf("switchbench: %d cycles per switch\n", (int)((yld - 2*sys) / 2));
+  exit(0);
+}
@@ -1,6 +1,7 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "kernel/fcntl.h"
+#include "kernel/procstat.h"
 #include "user/user.h"
 
 char*
@@ -134,3 +135,82 @@ memcpy(void *dst, const void *src, uint n)
 {
   return memmove(dst, src, n);
 }
+
+// Move the caller n priority levels down (n > 0) or up.
+// Returns the old level, or -1.
+int
+nice(int n)
+{
+  struct procstat st;
+
+  if(procstat(0, &st) < 0)
+    return -1;
+  return setpriority(0, st.nice + n);
+}
+
+// Mutexes, after Drepper's "Futexes Are Tricky": the word is
+// 0 when free, 1 when held, and 2 when held with (maybe)
+// threads asleep on it, so that an uncontended lock or unlock
+// is one atomic instruction, and only unlocking a lock that
+// others wait for costs a system call.
+void
+mutex_init(struct mutex *m)
+{
+  m->v = 0;
+}
+
+void
+mutex_lock(struct mutex *m)
+{
+  int c;
+
+  if((c = __sync_val_compare_and_swap(&m->v, 0, 1)) == 0)
+    return;
+  if(c != 2)
+    c = __sync_lock_test_and_set(&m->v, 2);
+  while(c != 0){
+    futex_wait(&m->v, 2);
+    c = __sync_lock_test_and_set(&m->v, 2);
+  }
+}
+
+void
+mutex_unlock(struct mutex *m)
+{
+  if(__sync_fetch_and_sub(&m->v, 1) != 1){
+    __atomic_store_n(&m->v, 0, __ATOMIC_RELEASE);
+    futex_wake(&m->v, 1);
+  }
+}
+
+// Condition variables: a waiter sleeps until seq moves
+// on from the value it saw while holding the mutex.
+void
+cond_init(struct cond *c)
+{
+  c->seq = 0;
+}
+
+void
+cond_wait(struct cond *c, struct mutex *m)
+{
+  int seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+
+  mutex_unlock(m);
+  futex_wait(&c->seq, seq);
+  mutex_lock(m);
+}
+
+void
+cond_signal(struct cond *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  futex_wake(&c->seq, 1);
+}
+
+void
+cond_broadcast(struct cond *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  futex_wake(&c->seq, 0x7fffffff);
+}
@@ -1,5 +1,8 @@
 struct stat;
 struct rtcdate;
+struct spawnact;
+struct procstat;
+struct bcachestat;
 
 // system calls
 int fork(void);
@@ -23,6 +26,19 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int spawn(char*, char**, struct spawnact*, int);
+void* mmap(void*, int, int, int, int, int);
+int munmap(void*, int);
+int setpriority(int, int);
+int procstat(int, struct procstat*);
+int nanosleep(uint64);
+int clone(void (*)(void*), void*, void*);
+int join(int, int*);
+int futex_wait(int*, int);
+int futex_wake(int*, int);
+int sched_setaffinity(int, uint64);
+int sched_yield(void);
+int bcachestat(struct bcachestat*);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -39,4 +55,20 @@ void* malloc(uint);
 void free(void*);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
+int nice(int);
 void *memcpy(void *, const void *, uint);
+
+// ulib.c: locks for threads (see clone()), on futexes.
+struct mutex {
+  int v;                        // 0 free, 1 held, 2 held and waited for
+};
+struct cond {
+  int seq;                      // count of signals
+};
+void mutex_init(struct mutex*);
+void mutex_lock(struct mutex*);
+void mutex_unlock(struct mutex*);
+void cond_init(struct cond*);
+void cond_wait(struct cond*, struct mutex*);
+void cond_signal(struct cond*);
+void cond_broadcast(struct cond*);
@@ -7,6 +7,8 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/procstat.h"
+#include "kernel/spawn.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -680,6 +682,84 @@ exectest(char *s)
 
 }
 
+// spawn() passes the arguments, applies the file actions to
+// the descriptors the child inherits, and hands the exit
+// status to wait(). a bad path fails without making a child.
+void
+spawntest(char *s)
+{
+  char *echoargv[] = { "echo", "spawn", "ok", 0 };
+  char *catargv[] = { "cat", "spawn-no-such-file", 0 };
+  char *badargv[] = { "spawn-no-such-program", 0 };
+  struct spawnact act[3];
+  char buf[32];
+  int fds[2], pid, n, tot, xstatus;
+
+  // echo's output goes to the pipe, as its fd 1.
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  act[0] = (struct spawnact){ SPAWN_DUP2, fds[1], 1 };
+  act[1] = (struct spawnact){ SPAWN_CLOSE, fds[0], 0 };
+  act[2] = (struct spawnact){ SPAWN_CLOSE, fds[1], 0 };
+  pid = spawn("echo", echoargv, act, 3);
+  if(pid < 0){
+    printf("%s: spawn echo failed\n", s);
+    exit(1);
+  }
+  close(fds[1]);
+  tot = 0;
+  while((n = read(fds[0], buf + tot, sizeof(buf) - 1 - tot)) > 0)
+    tot += n;
+  close(fds[0]);
+  buf[tot] = 0;
+  if(strcmp(buf, "spawn ok\n") != 0){
+    printf("%s: echo wrote \"%s\"\n", s, buf);
+    exit(1);
+  }
+  if(wait(&xstatus) != pid || xstatus != 0){
+    printf("%s: wait for echo failed\n", s);
+    exit(1);
+  }
+
+  // cat fails, and complains to the pipe, as its fd 2.
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  act[0] = (struct spawnact){ SPAWN_DUP2, fds[1], 2 };
+  act[1] = (struct spawnact){ SPAWN_CLOSE, fds[0], 0 };
+  act[2] = (struct spawnact){ SPAWN_CLOSE, fds[1], 0 };
+  pid = spawn("cat", catargv, act, 3);
+  if(pid < 0){
+    printf("%s: spawn cat failed\n", s);
+    exit(1);
+  }
+  close(fds[1]);
+  tot = 0;
+  while((n = read(fds[0], buf, sizeof(buf))) > 0)
+    tot += n;
+  close(fds[0]);
+  if(tot == 0){
+    printf("%s: cat wrote nothing to fd 2\n", s);
+    exit(1);
+  }
+  if(wait(&xstatus) != pid || xstatus != 1){
+    printf("%s: cat exit status %d, not 1\n", s, xstatus);
+    exit(1);
+  }
+
+  if(spawn("spawn-no-such-program", badargv, 0, 0) >= 0){
+    printf("%s: spawn of a bad path succeeded\n", s);
+    exit(1);
+  }
+  if(wait(0) != -1){
+    printf("%s: spawn of a bad path made a child\n", s);
+    exit(1);
+  }
+}
+
 // simple fork and pipe read/write
 
 void
@@ -2198,6 +2278,325 @@ sbrkarg(char *s)
   } 
 }
 
+// map a file privately and shared, and check the contents,
+// write-back, and sharing of a MAP_SHARED page with a child.
+void
+mmaptest(char *s)
+{
+  int fd, i, pid, xstatus;
+  char *p;
+  const int n = 2*PGSIZE + 100;
+
+  fd = open("mmapfile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: open mmapfile failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < n; i++)
+    buf[i] = 'a' + i % 23;
+  if(write(fd, buf, n) != n){
+    printf("%s: write mmapfile failed\n", s);
+    exit(1);
+  }
+
+  p = mmap(0, n, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p == (char*)-1){
+    printf("%s: mmap private failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < n; i++){
+    if(p[i] != 'a' + i % 23){
+      printf("%s: wrong data at %d\n", s, i);
+      exit(1);
+    }
+  }
+  p[0] = 'X';
+  if(munmap(p, n) != 0){
+    printf("%s: munmap private failed\n", s);
+    exit(1);
+  }
+
+  p = mmap(0, n, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == (char*)-1){
+    printf("%s: mmap shared failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    p[1] = 'Y';
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0 || p[1] != 'Y'){
+    printf("%s: child's store not seen\n", s);
+    exit(1);
+  }
+  p[0] = 'Z';
+  if(munmap(p, n) != 0){
+    printf("%s: munmap shared failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("mmapfile", O_RDONLY);
+  if(fd < 0 || read(fd, buf, 2) != 2 || buf[0] != 'Z' || buf[1] != 'Y'){
+    printf("%s: shared stores not written back\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("mmapfile");
+}
+
+// setpriority(), nice() and procstat(): levels are checked,
+// and a process that computes is charged ticks.
+void
+priotest(char *s)
+{
+  struct procstat st;
+  int pid;
+
+  if(setpriority(0, -1) != -1 || setpriority(0, NPRIO) != -1){
+    printf("%s: setpriority accepted a bad level\n", s);
+    exit(1);
+  }
+  if(setpriority(0, 1) != 0 || nice(1) != 1){
+    printf("%s: setpriority returned the wrong old level\n", s);
+    exit(1);
+  }
+  if(procstat(0, &st) < 0 || st.pid != getpid() || st.nice != 2){
+    printf("%s: procstat of self failed\n", s);
+    exit(1);
+  }
+  setpriority(0, 0);
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0)
+    for(;;)
+      ;
+  sleep(20);
+  if(procstat(pid, &st) < 0){
+    printf("%s: procstat of child failed\n", s);
+    exit(1);
+  }
+  kill(pid);
+  wait(0);
+  if(st.ticks == 0){
+    printf("%s: spinning child was charged no ticks\n", s);
+    exit(1);
+  }
+  if(procstat(pid, &st) != -1){
+    printf("%s: procstat of a dead process succeeded\n", s);
+    exit(1);
+  }
+}
+
+// sched_setaffinity(): a process pinned to hart 0 runs only
+// there, and its children inherit the pin.
+void
+affinitytest(char *s)
+{
+  struct procstat st;
+  int i, pid, xstatus;
+
+  if(sched_setaffinity(0, 0) != -1){
+    printf("%s: sched_setaffinity accepted an empty mask\n", s);
+    exit(1);
+  }
+  if(sched_setaffinity(0, 1) != 0){
+    printf("%s: sched_setaffinity failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 20; i++){
+    sleep(1);
+    if(procstat(0, &st) < 0 || st.cpu != 0){
+      printf("%s: pinned process ran on hart %d\n", s, st.cpu);
+      exit(1);
+    }
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    sleep(1);
+    if(procstat(0, &st) < 0 || st.affinity != 1 || st.cpu != 0)
+      exit(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  sched_setaffinity(0, -1);
+  if(xstatus != 0){
+    printf("%s: child did not inherit affinity\n", s);
+    exit(1);
+  }
+}
+
+static uint64
+rdtime(void)
+{
+  uint64 t;
+  asm volatile("rdtime %0" : "=r" (t));
+  return t;
+}
+
+// nanosleep() sleeps at least as long as asked, even for
+// less than a tick, and sleep() still counts ticks.
+void
+nanosleeptest(char *s)
+{
+  uint64 t0, t1;
+  int u0, u1;
+
+  for(int i = 0; i < 10; i++){
+    t0 = rdtime();
+    if(nanosleep(2000000 + i*100000) < 0){
+      printf("%s: nanosleep failed\n", s);
+      exit(1);
+    }
+    t1 = rdtime();
+    if(t1 - t0 < (2000000 + i*100000) / (1000000000 / TIMEFREQ)){
+      printf("%s: nanosleep woke after %d time units\n", s, (int)(t1 - t0));
+      exit(1);
+    }
+  }
+
+  u0 = uptime();
+  sleep(3);
+  u1 = uptime();
+  if(u1 - u0 < 3){
+    printf("%s: sleep(3) took %d ticks\n", s, u1 - u0);
+    exit(1);
+  }
+}
+
+static volatile int threadval;
+static int threadfd;
+
+static void
+threadworker(void *arg)
+{
+  // the creator's memory and open files.
+  threadval = *(int*)arg + 1;
+  close(threadfd);
+  exit(7);
+}
+
+// a thread made with clone() shares memory and open
+// files, and is joined rather than waited for.
+void
+threadtest(char *s)
+{
+  char *stack;
+  int *arg, fds[2], tid, xstatus;
+
+  stack = malloc(4096);
+  arg = malloc(sizeof(int));
+  *arg = 41;
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  threadfd = fds[1];
+  tid = clone(threadworker, arg, stack + 4096);
+  if(tid < 0){
+    printf("%s: clone failed\n", s);
+    exit(1);
+  }
+  if(wait(0) != -1){
+    printf("%s: wait() returned a thread\n", s);
+    exit(1);
+  }
+  if(join(tid, &xstatus) != tid || xstatus != 7){
+    printf("%s: join failed\n", s);
+    exit(1);
+  }
+  if(threadval != 42){
+    printf("%s: thread's store not seen\n", s);
+    exit(1);
+  }
+  if(write(fds[1], "x", 1) != -1){
+    printf("%s: thread's close() not seen\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  if(join(tid, 0) != -1){
+    printf("%s: joined a thread twice\n", s);
+    exit(1);
+  }
+  free(arg);
+  free(stack);
+}
+
+#define FUTEXNT 4
+#define FUTEXN  2000
+static struct mutex futexmu;
+static struct cond futexcv;
+static int futexcount, futexdone;
+
+static void
+futexworker(void *arg)
+{
+  for(int i = 0; i < FUTEXN; i++){
+    mutex_lock(&futexmu);
+    futexcount++;
+    mutex_unlock(&futexmu);
+  }
+  mutex_lock(&futexmu);
+  futexdone++;
+  cond_signal(&futexcv);
+  mutex_unlock(&futexmu);
+  exit(0);
+}
+
+// threads that share a counter under a mutex don't lose
+// updates, and a condition variable lets the creator wait
+// for them all to finish.
+void
+futextest(char *s)
+{
+  char *stack[FUTEXNT];
+  int i, tid[FUTEXNT], x = 1;
+
+  if(futex_wait(&x, 0) != -1){
+    printf("%s: futex_wait slept though the word differed\n", s);
+    exit(1);
+  }
+  mutex_init(&futexmu);
+  cond_init(&futexcv);
+  for(i = 0; i < FUTEXNT; i++){
+    stack[i] = malloc(4096);
+    if((tid[i] = clone(futexworker, 0, stack[i] + 4096)) < 0){
+      printf("%s: clone failed\n", s);
+      exit(1);
+    }
+  }
+  mutex_lock(&futexmu);
+  while(futexdone < FUTEXNT)
+    cond_wait(&futexcv, &futexmu);
+  mutex_unlock(&futexmu);
+  for(i = 0; i < FUTEXNT; i++){
+    if(join(tid[i], 0) != tid[i]){
+      printf("%s: join failed\n", s);
+      exit(1);
+    }
+    free(stack[i]);
+  }
+  if(futexcount != FUTEXNT * FUTEXN){
+    printf("%s: count is %d, not %d\n", s, futexcount, FUTEXNT * FUTEXN);
+    exit(1);
+  }
+}
+
 void
 validatetest(char *s)
 {
@@ -2364,6 +2763,40 @@ stacktest(char *s)
     exit(xstatus);
 }
 
+// the kernel can reach the stack guard page, which lacks PTE_U,
+// without faulting. system calls must not read or write it.
+void
+guardcopy(char *s)
+{
+  char *guard = (char *) (PGROUNDDOWN(r_sp()) - PGSIZE);
+  int fd, n;
+
+  fd = open("README", 0);
+  if(fd < 0){
+    printf("%s: open(README) failed\n", s);
+    exit(1);
+  }
+  n = read(fd, guard, 64);
+  if(n > 0){
+    printf("%s: read into guard page returned %d\n", s, n);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("guardcopy", O_CREATE|O_WRONLY);
+  if(fd < 0){
+    printf("%s: open(guardcopy) failed\n", s);
+    exit(1);
+  }
+  n = write(fd, guard, 64);
+  if(n > 0){
+    printf("%s: write from guard page returned %d\n", s, n);
+    exit(1);
+  }
+  close(fd);
+  unlink("guardcopy");
+}
+
 // regression test. copyin(), copyout(), and copyinstr() used to cast
 // the virtual page address to uint, which (with certain wild system
 // call arguments) resulted in a kernel page faults.
@@ -2666,6 +3099,7 @@ main(int argc, char *argv[])
     {fourfiles, "fourfiles"},
     {sharedfd, "sharedfd"},
     {exectest, "exectest"},
+    {spawntest, "spawntest"},
     {bigargtest, "bigargtest"},
     {bigwrite, "bigwrite"},
     {bsstest, "bsstest"},
@@ -2674,8 +3108,15 @@ main(int argc, char *argv[])
     {kernmem, "kernmem"},
     {sbrkfail, "sbrkfail"},
     {sbrkarg, "sbrkarg"},
+    {mmaptest, "mmaptest"},
+    {priotest, "priotest"},
+    {affinitytest, "affinitytest"},
+    {nanosleeptest, "nanosleeptest"},
+    {threadtest, "threadtest"},
+    {futextest, "futextest"},
     {validatetest, "validatetest"},
     {stacktest, "stacktest"},
+    {guardcopy, "guardcopy"},
     {opentest, "opentest"},
     {writetest, "writetest"},
     {writebig, "writebig"},
@@ -36,3 +36,16 @@ entry("getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
+entry("spawn");
+entry("mmap");
+entry("munmap");
+entry("setpriority");
+entry("procstat");
+entry("nanosleep");
+entry("clone");
+entry("join");
+entry("futex_wait");
+entry("futex_wake");
+entry("sched_setaffinity");
+entry("sched_yield");
+entry("bcachestat");
@@ -38,8 +38,8 @@ int main(int argc, char* argv[]) {
     } else {
       buf[offset++] = 0;
       arguments[count++] = p;
-      if (fork() != 0) {
-        exec(arguments[0], arguments);
+      arguments[count] = 0;
+      if (spawn(arguments[0], arguments, 0, 0) < 0) {
         fprintf(2, "exec failed\n");
         exit(1);
       }